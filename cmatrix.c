@@ -80,6 +80,47 @@ int setenv(const char *name, const char *value, int overwrite);
 #include <termio.h>
 #endif
 
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef HAVE_SYS_SIGNALFD_H
+#include <sys/signalfd.h>
+#endif
+
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#endif
+
+/* the ansi backend writes frames out with writev(). */
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#elif !defined(_WIN32)
+#error "sys/uio.h is needed, for writev()"
+#endif
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+/* --pipeline needs threads, atomics, and the ansi backend. */
+#if defined(HAVE_PTHREAD_H) && defined(HAVE_STDATOMIC_H) && !defined(_WIN32)
+#include <stdatomic.h>
+#define USE_PIPELINE
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_SYS_UN_H
+#include <sys/socket.h>
+#include <sys/un.h>
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
 #ifdef __CYGWIN__
 #define TIOCSTI 0x5412
 #endif
@@ -103,27 +144,235 @@ int setenv(const char *name, const char *value, int overwrite);
 #define MTX_FLAG_XWINDOW   0x00002000
 #define MTX_FLAG_UNICODE   0x00004000
 #define MTX_FLAG_OLD       0x00008000
+#define MTX_FLAG_ANSI      0x00010000
+#define MTX_FLAG_HUD       0x00020000
+#define MTX_FLAG_HISTOGRAM 0x00040000
+#define MTX_FLAG_FRAMESKIP 0x00080000
+#define MTX_FLAG_PIPELINE  0x00100000
+#define MTX_FLAG_BENCH     0x00200000
+#define MTX_FLAG_MLOCK     0x00400000
+#define MTX_FLAG_FADE      0x00800000
+
+/* matrix cells are a glyph, or one of these. */
+#define MTX_BLANK  0x00
+#define MTX_HEAD   0xff
 
-#define MTX_FLAG_FIRSTCOL  0x80000000
-#define MTX_FLAG_CONCURCOL 0x80000000
+/* what a cell looks like on screen: glyph in the low byte, then attrs. */
+#define MTX_CELL_GLYPH     0x00ff
+#define MTX_CELL_COLOR     0x0700
+#define MTX_CELL_BOLD      0x0800
+#define MTX_CELL_FADE      0xf000 /* how far down its trail, with --fade. */
+#define MTX_CELL_COLOR_SHIFT 8
+#define MTX_CELL_FADE_SHIFT 12
+#define MTX_CELL_INVALID   0xffff /* never drawn, forces a redraw. */
+#define MTX_CELL_COVERED   0xf000 /* under a -M box, so never drawn. */
 
-#define MTX_BLANK  -1
-#define MTX_HEAD   -2
+/* glyph 0 is a blank, and no mode uses 255 for a char. */
+#define MTX_GLYPH_LAMBDA   0xff
 
 #define NUM_COLORS 7
 
 /* Global variables */
 uint32_t flags = MTX_FLAG_ASYNC;
 
-int **matrix = NULL;
+char *color_names[NUM_COLORS] = {"green",     "red",     "blue",     "yellow",     "cyan",     "magenta",     "white"};
+int color_vals[NUM_COLORS]    = {COLOR_GREEN, COLOR_RED, COLOR_BLUE, COLOR_YELLOW, COLOR_CYAN, COLOR_MAGENTA, COLOR_WHITE};
+
+/* Only every other screen col is drawn, so only those are kept.
+   Each one is LINES cells in a row, top to bottom. */
+int ncols = 0;
+int var_lines = 0; /* LINES, when everything was last allocated. */
+uint8_t *matrix = NULL;
 int *length = NULL;  /* Length of cols in each line */
 int *spaces = NULL;  /* Spaces left to fill */
-int *updates = NULL; /* Determines frequency of updates on each line (-a) */
+/* -a moves each col along once every col_period[j] frames, in 16.16
+   fixed point, so a col can have any speed. col_due[j] is when it next
+   moves, in the same units, counted by band_tick. */
+uint32_t *col_period = NULL;
+uint32_t *col_due = NULL;
+int *col_next = NULL; /* next col in the same wheel slot, -1 at the end. */
+uint32_t band_tick = 0; /* frames moved along so far, wrapping. */
+/* -o scrolls by moving where each col starts instead of moving its cells,
+   so the top line of col j is matrix[j * LINES + offset[j]], wrapping
+   around. new-style scrolling always keeps offset at 0. */
+int *offset = NULL;
+int *run = NULL;     /* Non-blank cells at the top of each col (-o) */
+
+/* new-style scrolling keeps track of its streams instead of looking
+   for them in the cells. a stream is lines top to end-1 of its col. */
+typedef struct
+{
+	uint16_t top, end;
+} mtx_seg;
+
+int seg_max = 0;      /* room for streams per col */
+mtx_seg *segs = NULL; /* seg_max per col, top to bottom */
+int *nsegs = NULL;    /* Streams in each col */
+uint16_t *shadow = NULL; /* What's currently on screen, laid out like matrix */
+uint16_t *cover = NULL;  /* 0xffff under the -M boxes, 0 everywhere else. */
+
+/* Where frames go. Cells use the MTX_CELL_* layout, and so do attrs. */
+typedef struct
+{
+	void (*draw_cell)(int y, int x, uint16_t cell);
+	void (*draw_str)(int y, int x, const char *str, uint16_t attrs);
+	void (*flush)(void); /* get the frame onto the terminal. */
+	int (*get_key)(void); /* ERR if there's nothing. */
+	void (*clear_screen)(void); /* along with the next flush. */
+	void (*stop)(void);
+} mtx_backend;
+
+mtx_backend *out = NULL; /* NULL until the terminal is set up. */
+#ifndef _WIN32
+int ansi_in = STDIN_FILENO, ansi_out = STDOUT_FILENO; /* the ansi backend's tty. */
+
+/* A cell that's been drawn but not turned into escape codes yet. */
+typedef struct
+{
+	uint16_t y, x, cell;
+} ansi_cell;
+
+/* Escape codes for part of a frame, and where they leave the terminal. */
+typedef struct
+{
+	char *buf; /* reused between frames, only ever grows. */
+	size_t len, cap;
+	int y, x; /* terminal's cursor, -1 if unknown. */
+	uint16_t attrs; /* terminal's current attrs. */
+	ansi_cell *cells, *sorted; /* waiting for ansi_emit(), and its scratch. */
+	size_t ncells, cells_cap;
+	uint32_t *starts; /* ansi_emit()'s too, one per attrs and line. */
+	size_t nstarts;
+} ansi_frag;
+
+/* One of the ttys, with more than one -t. */
+#define MAX_TTYS 64
+#define TTY_BACKLOG (1 << 20) /* bytes a tty can be behind by. */
+typedef struct
+{
+	char *name;
+	int fd; /* -1 once it's gone away. */
+	ansi_frag q; /* what it hasn't taken yet, from q_off on. */
+	size_t q_off;
+	int stale; /* lost some frames, needs the whole screen. */
+#ifdef HAVE_TERMIOS_H
+	struct termios saved;
+	int have_saved;
+#endif
+} mtx_tty;
+
+mtx_tty ttys[MAX_TTYS];
+int nttys = 0; /* only used with more than one -t. */
+
+/* The smallest size of all the -t ttys, 0 if none of them say. */
+int ttys_size(int *lines, int *cols)
+{
+	struct winsize win;
+	int k;
+
+	*lines = *cols = 0;
+	for(k=0; k<nttys; k++)
+	{
+		if(ttys[k].fd < 0 || ioctl(ttys[k].fd, TIOCGWINSZ, &win) == -1 || !win.ws_row || !win.ws_col)
+			continue;
+		if(!*lines || win.ws_row < *lines)
+			*lines = win.ws_row;
+		if(!*cols || win.ws_col < *cols)
+			*cols = win.ws_col;
+	}
+	return *lines != 0;
+}
+
+/* Size of the ansi backend's tty, or the smallest of them so the
+   matrix fits on all of them. 0 if nobody knows. */
+int ansi_size(void)
+{
+	struct winsize win;
+	int lines, cols;
+
+	if(!nttys)
+	{
+		if(ioctl(ansi_out, TIOCGWINSZ, &win) == -1 || !win.ws_row || !win.ws_col)
+			return 0;
+		LINES = win.ws_row;
+		COLS = win.ws_col;
+		return 1;
+	}
+	if(!ttys_size(&lines, &cols))
+		return 0;
+	LINES = lines;
+	COLS = cols;
+	return 1;
+}
+
+/* SIGWINCH only comes from our own terminal, so the -t ttys get asked
+   for their size twice a second instead. 1 if the smallest of them
+   isn't what it was last time. */
+int ttys_resized(uint64_t now)
+{
+	static uint64_t when = 0;
+	static int last_lines = 0, last_cols = 0;
+	int lines, cols, changed;
+
+	if(when && now - when < 500000000ULL)
+		return 0;
+	when = now;
+	if(!ttys_size(&lines, &cols))
+		return 0;
+	changed = last_lines && (lines != last_lines || cols != last_cols);
+	last_lines = lines;
+	last_cols = cols;
+	return changed;
+}
+#endif
+
+/* Every col gets its own random number generator, which hands out
+   values from a buffer that gets filled RNG_BULK at a time. */
+#define RNG_BULK 16
+typedef struct
+{
+	uint32_t s[4]; /* xoshiro128** state, or s[0] is where -p is up to. */
+	int pos;       /* next value to use from buf. */
+	uint32_t buf[RNG_BULK];
+} mtx_rng;
+
+mtx_rng *rngs = NULL; /* one per col */
+uint64_t seed = 0;    /* set by --seed, then moved along by every rng_seed(). */
+
+/* --threads splits the cols into bands, each moved along (and with
+   --ansi, drawn) by its own thread. every col has its own rng, so the
+   matrix comes out the same however many bands there are. */
+#define MAX_THREADS 64
+/* -a's timing wheel: slot t % WHEEL_SLOTS lists the band's cols due on
+   frame t, so a frame only looks at the cols that move. a col slower
+   than that many frames goes round more than once before it's due. */
+#define WHEEL_SLOTS 16
+typedef struct
+{
+	int j0, j1; /* cols j0 up to j1. */
+	int wheel[WHEEL_SLOTS]; /* first col in each slot, -1 if none. */
+	uint64_t cells; /* drawn this frame. */
+	uint64_t update_ns, draw_ns; /* this frame. */
+#ifndef _WIN32
+	ansi_frag frag; /* the band's part of the frame, when it draws itself. */
+#endif
+#ifdef HAVE_PTHREAD_H
+	pthread_t thread;
+#endif
+	/* a cache line between this band's counters and the next's, so
+	   threads never write to the same one. the bands themselves
+	   aren't aligned to anything. */
+	char pad[64];
+} mtx_band;
+
+mtx_band bands[MAX_THREADS];
+int nthreads = 1;
+int band_frags = 0; /* bands draw into their own frags, not through out. */
 
 #define RAND_LEN_MIN 512
 #define RAND_LEN_MAX 8192
 uint32_t rand_len = 1024; /* length of prealloc values. can be changed by arg. */
-int *rand_array = NULL; /* preallocated rand values. */
+uint32_t *rand_array = NULL; /* preallocated rand values. */
 int randmin = 33, randmax=123; /* min is inclusive, max is exclusive. */
 
 /* unicode chars. */
@@ -144,6 +393,101 @@ char *chars_array[CHARS_LEN] =
 volatile sig_atomic_t signal_status = 0; /* Indicates a caught signal */
 #endif
 
+/* Where the time goes, added up over every frame. */
+typedef struct
+{
+	uint64_t frames;
+	uint64_t update_ns, draw_ns, flush_ns;
+	uint64_t cells; /* drawn, because they changed. */
+	uint64_t late;  /* frames that started after their deadline. */
+	uint64_t skipped; /* frames not drawn to catch up (--frameskip). */
+	uint64_t bytes; /* written out, with --ansi. */
+} mtx_stats;
+
+mtx_stats stats;
+
+/* Time from one frame to the next, in microseconds. buckets 0-7 are
+   exact, after that there are eight per power of two. */
+#define HIST_BUCKETS 256
+uint64_t hist[HIST_BUCKETS];
+uint64_t hist_max = 0;
+
+int hist_bucket(uint64_t us)
+{
+	int o = 3;
+
+	if(us < 8)
+		return us;
+	while(us >> (o+1))
+		o++;
+	if(8*(o-2) + 7 >= HIST_BUCKETS)
+		return HIST_BUCKETS - 1;
+	return 8*(o-2) + ((us >> (o-3)) & 7);
+}
+
+/* Smallest time that goes in bucket b. */
+uint64_t hist_floor(int b)
+{
+	if(b < 8)
+		return b;
+	return (uint64_t) (8 + b%8) << (b/8 - 1);
+}
+
+void hist_add(uint64_t us)
+{
+	hist[hist_bucket(us)]++;
+	if(us > hist_max)
+		hist_max = us;
+}
+
+/* The time that p percent of frames were quicker than. */
+uint64_t hist_percentile(double p)
+{
+	uint64_t total = 0, seen = 0;
+	int b;
+
+	for(b=0; b<HIST_BUCKETS; b++)
+		total += hist[b];
+	for(b=0; b<HIST_BUCKETS; b++)
+	{
+		seen += hist[b];
+		if(seen && seen >= total * p / 100)
+			return b+1 < HIST_BUCKETS && hist_floor(b+1) < hist_max ? hist_floor(b+1) : hist_max;
+	}
+	return hist_max;
+}
+
+/* --histogram prints this to stderr on the way out. */
+void hist_print(void)
+{
+	uint64_t most = 0;
+	int b;
+
+	for(b=0; b<HIST_BUCKETS; b++)
+		if(hist[b] > most)
+			most = hist[b];
+	if(!most)
+		return;
+
+	fprintf(stderr, "cmatrix: frame times, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+	        hist_percentile(50) / 1e3, hist_percentile(99) / 1e3, hist_max / 1e3);
+	if(stats.late)
+		fprintf(stderr, "cmatrix: %llu frames late, %llu not drawn\n",
+		        (unsigned long long) stats.late, (unsigned long long) stats.skipped);
+	for(b=0; b<HIST_BUCKETS; b++)
+	{
+		int bar;
+		if(!hist[b])
+			continue;
+		fprintf(stderr, " %10.3f ms %8llu ", hist_floor(b) / 1e3, (unsigned long long) hist[b]);
+		for(bar = hist[b] * 50 / most; bar > 0; bar--)
+			fputc('#', stderr);
+		fputc('\n', stderr);
+	}
+}
+uint64_t bench_frames = 0; /* --bench, --cast and --ttyrec run this many frames with no terminal. */
+int bench_lines = 24, bench_cols = 80; /* --size */
+
 int va_system(char *str, ...)
 {
 	va_list ap;
@@ -158,11 +502,8 @@ int va_system(char *str, ...)
 /* What we do when we're all set to exit */
 void finish(void)
 {
-	curs_set(1);
-	clear();
-	refresh();
-	resetty();
-	endwin();
+	if(out)
+		out->stop();
 #ifdef HAVE_CONSOLECHARS
 	if(flags & MTX_FLAG_LINUX)
 		va_system("consolechars -d");
@@ -170,6 +511,8 @@ void finish(void)
 	if(flags & MTX_FLAG_LINUX)
 		va_system("setfont");
 #endif
+	if(flags & MTX_FLAG_HISTOGRAM)
+		hist_print();
 	exit(0);
 }
 
@@ -178,11 +521,8 @@ void c_die(char *msg, ...)
 {
 	va_list ap;
 
-	curs_set(1);
-	clear();
-	refresh();
-	resetty();
-	endwin();
+	if(out)
+		out->stop();
 #ifdef HAVE_CONSOLECHARS
 	if(flags & MTX_FLAG_LINUX)
 		va_system("consolechars -d");
@@ -217,27 +557,131 @@ char usage[] =
 	" -m: Lambda mode.\n"
 #endif
 	" -M [message]: Prints your message in the center of the screen. Overrides -L's default message.\n"
+	"     Each -M gets its own box, and newlines in one start new lines.\n"
 	" -n: No bold characters (overrides -b and -B, default).\n"
 	" -o: Use old-style (real) scrolling.\n"
 	" -p: Preallocate rand values ahead of time.\n"
 	" -P [count]: Specify number of rand values to prealloc. (Implies -p.)\n"
 	" -r: Rainbow mode.\n"
 	" -s: Screensaver mode, exits on first keystroke.\n"
-	" -t [tty]: Set tty to use.\n"
-	" -u [delay]: Screen update delay (0 - 10, default 4).\n"
+	" -t [tty]: Set tty to use. Give it more than once to show the same matrix on all of them (implies --ansi).\n"
+	" -u [delay]: Screen update delay, frames start every delay * 10ms (0 - 10, default 4).\n"
 	" -V: Print version information and exit.\n"
 	" -x: XTerm mode (for use with mtx.pcf).\n"
+#ifndef _WIN32
+	" --ansi: Write escape codes straight to the terminal instead of using curses.\n"
+	" --fade: Fade each trail out behind its head, with 256 or 24-bit colors. Implies --ansi.\n"
+#endif
+	" --seed [number]: Seed the random numbers, for the same matrix every time.\n"
+	" --histogram: Print how long frames took to stderr when exiting.\n"
+	" --frameskip: Don't draw frames that start late, to keep up the speed.\n"
+#ifdef HAVE_PTHREAD_H
+	" --threads [count]: Share the cols out between this many threads (default 1).\n"
+#endif
+#ifdef USE_PIPELINE
+	" --pipeline: Write to the terminal from its own thread, dropping frames if it's slow. Implies --ansi.\n"
+#endif
+	" --record [file]: Save what's on screen every frame to file.\n"
+	" --replay [file]: Play a recording back instead of making a new matrix.\n"
+	" --speed [times]: Play it this many times as fast (default 1, 0 is as fast as possible).\n"
+	" --seek [secs]: Start playing this far in.\n"
+#ifdef HAVE_SYS_MMAN_H
+	" --mlock: Keep the matrix's memory from being swapped out, e.g. with -L.\n"
+#endif
+#ifdef HAVE_SYS_UN_H
+	" --control [path]: Take commands and answer questions about the stats on a unix socket at path.\n"
+#endif
+#ifndef _WIN32
+	" --bench [frames]: Time this many frames with no terminal, as fast as possible.\n"
+	" --size [COLSxLINES]: Screen size for --bench, --cast and --ttyrec (default 80x24).\n"
+	" --cast [file]: Write an asciicast v2 clip to file (- for stdout) with no terminal.\n"
+	" --ttyrec [file]: Write a ttyrec clip to file (- for stdout) with no terminal.\n"
+	" --frames [count]: Number of frames in the clip (default 250).\n"
+#endif
 #ifndef HAVE_NCURSESW_NCURSES_H
 	" Ignored for compatibility with disabled features: -c -m\n"
 #endif
 	; /* annoying, but i don't see a way around it, as the last line is inconsistent. */
 
+/* long-only options get values past any char. */
+#define OPT_ANSI 256
+#define OPT_SEED 257
+#define OPT_BENCH 258
+#define OPT_SIZE 259
+#define OPT_HISTOGRAM 260
+#define OPT_FRAMESKIP 261
+#define OPT_THREADS 262
+#define OPT_PIPELINE 263
+#define OPT_RECORD 264
+#define OPT_REPLAY 265
+#define OPT_SPEED 266
+#define OPT_SEEK 267
+#define OPT_CAST 268
+#define OPT_TTYREC 269
+#define OPT_FRAMES 270
+#define OPT_MLOCK 271
+#define OPT_FADE 272
+#define OPT_CONTROL 273
+
+struct option long_options[] =
+{
+#ifndef _WIN32
+	{"ansi", no_argument, NULL, OPT_ANSI},
+	{"fade", no_argument, NULL, OPT_FADE},
+#endif
+	{"seed", required_argument, NULL, OPT_SEED},
+	{"histogram", no_argument, NULL, OPT_HISTOGRAM},
+	{"frameskip", no_argument, NULL, OPT_FRAMESKIP},
+#ifdef HAVE_PTHREAD_H
+	{"threads", required_argument, NULL, OPT_THREADS},
+#endif
+#ifdef USE_PIPELINE
+	{"pipeline", no_argument, NULL, OPT_PIPELINE},
+#endif
+	{"record", required_argument, NULL, OPT_RECORD},
+	{"replay", required_argument, NULL, OPT_REPLAY},
+	{"speed", required_argument, NULL, OPT_SPEED},
+	{"seek", required_argument, NULL, OPT_SEEK},
+#ifndef _WIN32
+	{"cast", required_argument, NULL, OPT_CAST},
+	{"ttyrec", required_argument, NULL, OPT_TTYREC},
+	{"frames", required_argument, NULL, OPT_FRAMES},
+#ifdef HAVE_SYS_MMAN_H
+	{"mlock", no_argument, NULL, OPT_MLOCK},
+#endif
+#ifdef HAVE_SYS_UN_H
+	{"control", required_argument, NULL, OPT_CONTROL},
+#endif
+	{"bench", required_argument, NULL, OPT_BENCH},
+	{"size", required_argument, NULL, OPT_SIZE},
+#endif
+	{NULL, 0, NULL, 0}
+};
+
 char version[] =
 	" CMatrix version " VERSION " (compiled " __TIME__ ", " __DATE__ ")\n"
 	" Copyright (C) 2025-2026       Xylia Allegretta\n"
 	" Copyright (C) 1999-2002, 2024 Chris Allegretta\n"
 	" Copyright (C) 2017-2019       Abishek V Ashok\n";
 
+/* Nanoseconds on a clock that only ever goes forwards. */
+uint64_t now_ns(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER freq, count;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (count.QuadPart / freq.QuadPart) * 1000000000ULL
+	       + (count.QuadPart % freq.QuadPart) * 1000000000ULL / freq.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
 /* nmalloc from nano by Big Gaute */
 void *nmalloc(size_t howmuch) {
 	void *r;
@@ -247,21 +691,94 @@ void *nmalloc(size_t howmuch) {
 	return r;
 }
 
+void *nrealloc(void *ptr, size_t howmuch)
+{
+	void *r;
+
+	if(!(r = realloc(ptr, howmuch)))
+		c_die("realloc: out of memory!\n");
+	return r;
+}
+
+uint32_t rotl(uint32_t x, int k)
+{
+	return (x << k) | (x >> (32 - k));
+}
+
+/* xoshiro128** by Blackman and Vigna. */
+void rng_fill_xoshiro(mtx_rng *r)
+{
+	uint32_t *s = r->s;
+	int i;
+
+	for(i=0; i<RNG_BULK; i++)
+	{
+		uint32_t t = s[1] << 9;
+		r->buf[i] = rotl(s[1] * 5, 7) * 9;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = rotl(s[3], 11);
+	}
+	r->pos = 0;
+}
+
 /* Pre-allocate an array to read from, to reduce ongoing CPU-utilization on older systems */
-int rand_pre()
+void rng_fill_pre(mtx_rng *r)
 {
-	static int index = 0;
-	int next;
+	uint32_t i, k = r->s[0] % rand_len;
 
-	next = rand_array[index];
-	index++;
-	index%=rand_len;
+	for(i=0; i<RNG_BULK; i++)
+	{
+		r->buf[i] = rand_array[k];
+		if(++k == rand_len)
+			k = 0;
+	}
+	r->s[0] = k;
+	r->pos = 0;
+}
+
+/* this is what will actually be called. changed to rng_fill_pre by -p. we love function pointers. */
+void (*rng_fill)(mtx_rng *r) = &rng_fill_xoshiro;
+
+static inline uint32_t rng_next(mtx_rng *r)
+{
+	if(r->pos == RNG_BULK)
+		rng_fill(r);
+	return r->buf[r->pos++];
+}
+
+/* A number from 0 to n-1, by multiplying and shifting instead of %. */
+static inline uint32_t rng_range(mtx_rng *r, uint32_t n)
+{
+	return ((uint64_t) rng_next(r) * n) >> 32;
+}
 
-	return next;
+/* splitmix64, to turn one seed into lots of unrelated ones. */
+uint64_t splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
 }
 
-/* this is what will actually be called. changed to rand_pre by -p. we love function pointers. */
-int (*rand_func)(void) = &rand;
+/* Give r its own state, taken from seed. */
+void rng_seed(mtx_rng *r)
+{
+	uint64_t a = splitmix64(&seed), b = splitmix64(&seed);
+
+	r->s[0] = a;
+	r->s[1] = a >> 32;
+	r->s[2] = b;
+	r->s[3] = b >> 32;
+	/* all zeroes would only ever give zeroes. */
+	if(!(r->s[0] | r->s[1] | r->s[2] | r->s[3]))
+		r->s[0] = 1;
+	r->pos = RNG_BULK;
+}
 
 /* If we're pre-allocating a string of random ints to save
    energy, do it here. Add a fun screen message while we do it */
@@ -269,206 +786,3146 @@ void rand_pre_init()
 {
 	int i, nextchar = 0, segment_size;
 	char *funstring = "Knock, knock, Neo.";
+	char c[2] = {0, 0};
+	mtx_rng r;
 
-	/* change pointer! */
-	rand_func = &rand_pre;
-
-	/* bold green text. */
-	attron(COLOR_PAIR(COLOR_GREEN));
-	attron(A_BOLD);
-
-	/* not very necessary, as this function is only called once. */
-	if(rand_array != NULL)
-		free(rand_array);
+	rng_seed(&r);
 
-	/* allocate array. */
-	rand_array = nmalloc(sizeof(int) * (rand_len+1));
-
-	/* print first char. */
-	mvaddch(0, 0, funstring[0]);
+	/* print first char, in bold green. rand_array is already there,
+	   in the arena along with everything else. */
+	c[0] = funstring[0];
+	out->draw_str(0, 0, c, (COLOR_GREEN << MTX_CELL_COLOR_SHIFT) | MTX_CELL_BOLD);
+	out->flush();
 	nextchar++;
 
 	/* print chars of string as chunks are given random numbers. */
 	segment_size = rand_len / strlen(funstring) - 2;
 	for(i=0; i<=rand_len; i++)
 	{
-	 	rand_array[i] = rand();
+		if(r.pos == RNG_BULK)
+			rng_fill_xoshiro(&r);
+	 	rand_array[i] = r.buf[r.pos++];
 
 		if(i/segment_size > nextchar && nextchar<strlen(funstring))
 		{
-			addch(funstring[nextchar]);
-			refresh();
+			c[0] = funstring[nextchar];
+			out->draw_str(0, nextchar, c, (COLOR_GREEN << MTX_CELL_COLOR_SHIFT) | MTX_CELL_BOLD);
+			out->flush();
 			nextchar++;
-			napms(180);
+			if(!bench_frames)
+				napms(180);
 		}
 	}
 
+	/* change pointer! and throw away what the cols already have. */
+	rng_fill = &rng_fill_pre;
+	for(i=0; i<ncols; i++)
+		rngs[i].pos = RNG_BULK;
+
 	/* return screen to normal. */
-	attroff(COLOR_PAIR(COLOR_GREEN));
-	attroff(A_BOLD);
-	erase();
+	out->clear_screen();
 }
 
-/* Initialize the global variables */
-void var_init()
+/* Find the streams in col j from its cells, for new-style scrolling. */
+void find_segs(int j)
 {
-	int i;
+	uint8_t *col = matrix + j * LINES;
+	mtx_seg *seg = segs + j * seg_max;
+	int i = 0, n = 0;
+
+	while(i < LINES)
+	{
+		while(i < LINES && col[i] == MTX_BLANK)
+			i++;
+		if(i >= LINES)
+			break;
+		seg[n].top = i;
+		while(i < LINES && col[i] != MTX_BLANK)
+			i++;
+		seg[n++].end = i;
+	}
+	nsegs[j] = n;
+}
 
-	if(matrix != NULL)
+/* Reverse col[a] up to col[b-1]. */
+void col_reverse(uint8_t *col, int a, int b)
+{
+	while(a < --b)
 	{
-		free(matrix[0]);
-		free(matrix);
+		uint8_t tmp = col[a];
+		col[a++] = col[b];
+		col[b] = tmp;
 	}
+}
+
+/* Turn -o's ring in col j back into cells top to bottom, in place. */
+void col_unroll(int j, int lines)
+{
+	uint8_t *col = matrix + j * lines;
+
+	if(!offset[j])
+		return;
+	col_reverse(col, 0, offset[j]);
+	col_reverse(col, offset[j], lines);
+	col_reverse(col, 0, lines);
+	offset[j] = 0;
+}
 
-	/* 2d char field. */
-	matrix = nmalloc(sizeof(int*) * LINES);
-	matrix[0] = nmalloc(sizeof(int) * LINES * COLS);
-	for(i=1; i<LINES; i++)
-		matrix[i] = matrix[i - 1] + COLS;
+/* === per-screen state ===
+   everything that depends on the screen size lives in one block, with
+   each array starting on its own cache line. it's laid out for
+   arena_cols by arena_lines, which only ever grow, so a resize that
+   fits just moves the cells around inside it. */
+#define ARENA_ALIGN 64
+#define ARENA_ROUND 16 /* room for this many more cols or lines at a time. */
+char *arena = NULL, *arena_base = NULL; /* base is what malloc gave us. */
+size_t arena_size = 0;
+int arena_cols = 0, arena_lines = 0;
 
-	/* lengths of cols. */
-	if(length != NULL)
-		free(length);
-	length = nmalloc(COLS * sizeof(int));
+#define ARENA_PUT(ptr, n) do { \
+		if(a) \
+			ptr = (void *) (a + at); \
+		at += ((n) + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1); \
+	} while(0)
 
-	/* spaces between calls. */
-	if(spaces != NULL)
-		free(spaces);
-	spaces = nmalloc(COLS * sizeof(int));
+/* Point everything into a, laid out for cols by lines. Returns how
+   big that is, and a can be NULL to only find that out. */
+size_t arena_layout(char *a, int cols, int lines)
+{
+	size_t at = 0;
+
+	if(flags & MTX_FLAG_PREALLOC)
+		ARENA_PUT(rand_array, (rand_len+1) * sizeof(uint32_t));
+	ARENA_PUT(rngs, cols * sizeof(mtx_rng));
+	ARENA_PUT(length, cols * sizeof(int));
+	ARENA_PUT(spaces, cols * sizeof(int));
+	ARENA_PUT(col_period, cols * sizeof(uint32_t));
+	ARENA_PUT(col_due, cols * sizeof(uint32_t));
+	ARENA_PUT(col_next, cols * sizeof(int));
+	ARENA_PUT(offset, cols * sizeof(int));
+	ARENA_PUT(run, cols * sizeof(int));
+	ARENA_PUT(nsegs, cols * sizeof(int));
+	ARENA_PUT(matrix, (size_t) cols * lines);
+	ARENA_PUT(shadow, (size_t) cols * lines * sizeof(uint16_t));
+	ARENA_PUT(cover, (size_t) cols * lines * sizeof(uint16_t));
+	/* streams need a blank between them, plus one for a new
+	   stream that hasn't been joined up with the one below yet. */
+	ARENA_PUT(segs, (size_t) cols * ((lines+1)/2 + 1) * sizeof(mtx_seg));
+	return at;
+}
+
+/* Make arena big enough for ncols by LINES, bringing along the first
+   keep cols of everything, which are old_lines long. */
+void arena_grow(int keep, int old_lines)
+{
+	char *old_base = arena_base;
+#ifdef HAVE_SYS_MMAN_H
+	size_t old_size = arena_size;
+#endif
+	int *old_length = length, *old_spaces = spaces;
+	uint32_t *old_period = col_period, *old_due = col_due;
+	mtx_rng *old_rngs = rngs;
+	uint8_t *old_matrix = matrix;
+	uint32_t *old_rand = rand_array;
+	int j;
+
+	if(ncols > arena_cols)
+		arena_cols = ncols + ARENA_ROUND - 1 - (ncols - 1) % ARENA_ROUND;
+	if(LINES > arena_lines)
+		arena_lines = LINES + ARENA_ROUND - 1 - (LINES - 1) % ARENA_ROUND;
+	arena_size = arena_layout(NULL, arena_cols, arena_lines);
+	arena_base = nmalloc(arena_size + ARENA_ALIGN - 1);
+	arena = arena_base + (ARENA_ALIGN - (uintptr_t) arena_base % ARENA_ALIGN) % ARENA_ALIGN;
+	memset(arena, 0, arena_size);
+	arena_layout(arena, arena_cols, arena_lines);
 
-	if(updates != NULL)
-		free(updates);
-	updates = nmalloc(COLS * sizeof(int));
+#ifdef HAVE_SYS_MMAN_H
+	/* the lock screen's state stays in memory, never in swap. */
+	if((flags & MTX_FLAG_MLOCK) && mlock(arena, arena_size))
+		c_die("Couldn't lock %lu bytes in memory: %s\n", (unsigned long) arena_size, strerror(errno));
+#endif
 
-	/* Make the matrix */
-	for(i = 0; i < LINES; i++)
+	if(!old_base)
+		return;
+	if(old_rand)
+		memcpy(rand_array, old_rand, (rand_len+1) * sizeof(uint32_t));
+	memcpy(rngs, old_rngs, keep * sizeof(mtx_rng));
+	memcpy(length, old_length, keep * sizeof(int));
+	memcpy(spaces, old_spaces, keep * sizeof(int));
+	memcpy(col_period, old_period, keep * sizeof(uint32_t));
+	memcpy(col_due, old_due, keep * sizeof(uint32_t));
+	for(j=0; j<keep; j++)
 	{
-		int j;
-		for(j=0; j<COLS; j+=2)
-			matrix[i][j] = MTX_BLANK;
+		memset(matrix + j * LINES, MTX_BLANK, LINES);
+		memcpy(matrix + j * LINES, old_matrix + j * old_lines, LINES < old_lines ? LINES : old_lines);
+	}
+#ifdef HAVE_SYS_MMAN_H
+	if(flags & MTX_FLAG_MLOCK)
+		munlock(old_base, old_size + ARENA_ALIGN - 1);
+#endif
+	free(old_base);
+}
+
+/* Put col j in band b's wheel, in the slot for when it's due. */
+static inline void wheel_add(mtx_band *b, int j)
+{
+	int *slot = &b->wheel[(col_due[j] >> 16) % WHEEL_SLOTS];
+
+	col_next[j] = *slot;
+	*slot = j;
+}
+
+/* Put every col back in its band's wheel, for when the bands have
+   changed, or the wheel has stood still while frames went by. A col
+   is never due more than its period ahead, so one that is was due
+   in the meantime, and is due on the next frame instead. */
+void wheel_build(void)
+{
+	uint32_t next = (band_tick + 1) << 16;
+	int i, j;
+
+	for(i=0; i<nthreads; i++)
+	{
+		for(j=0; j<WHEEL_SLOTS; j++)
+			bands[i].wheel[j] = -1;
+		for(j=bands[i].j0; j<bands[i].j1; j++)
+		{
+			if(col_due[j] - next > col_period[j])
+				col_due[j] = next;
+			wheel_add(&bands[i], j);
+		}
+	}
+}
+
+/* === -M and -L ===
+   message boxes, on top of the matrix. cover marks the cells under
+   them, and the kernels turn those into MTX_CELL_COVERED, which is
+   what shadow already has there, so the matrix is never drawn just to
+   be drawn over. the boxes themselves only go out again when they've
+   moved, or something else was drawn over them. */
+#define OVERLAY_BOXES 16
+typedef struct
+{
+	const char *text; /* as it was given. */
+	char **lines; /* the text centered in blanks, all width long. */
+	int nlines, width;
+	int y, x; /* top left, from overlay_place(). */
+} mtx_box;
+
+mtx_box boxes[OVERLAY_BOXES];
+int nboxes = 0;
+int overlay_shown = 0; /* the boxes are on screen where they are now. */
+
+/* Add a box for text, with a line for each '\n' in it. */
+void overlay_add(const char *text)
+{
+	mtx_box *b = &boxes[nboxes];
+	const char *s, *e;
+	int i, n = 0, w = 0;
+
+	if(nboxes == OVERLAY_BOXES)
+		c_die("Too many messages, the most is %d.\n", OVERLAY_BOXES);
+	for(s = text; ; s = e + 1)
+	{
+		e = s + strcspn(s, "\n");
+		if(e - s > w)
+			w = e - s;
+		n++;
+		if(!*e)
+			break;
+	}
+
+	/* a blank line above and below, and 2 blanks either side. */
+	b->text = text;
+	b->width = w + 4;
+	b->nlines = n + 2;
+	b->lines = nmalloc(b->nlines * sizeof(char *));
+	for(i=0; i<b->nlines; i++)
+	{
+		b->lines[i] = nmalloc(b->width + 1);
+		memset(b->lines[i], ' ', b->width);
+		b->lines[i][b->width] = 0;
+	}
+	for(i = 1, s = text; i <= n; i++, s = e + 1)
+	{
+		e = s + strcspn(s, "\n");
+		memcpy(b->lines[i] + 2 + (w - (e - s)) / 2, s, e - s);
+	}
+	nboxes++;
+}
+
+/* Every box's text, with a '\f' between them, or NULL if there are
+   none. --record keeps this, and --replay splits it back up. */
+char *overlay_text(void)
+{
+	size_t len = 0;
+	char *text;
+	int k;
+
+	if(!nboxes)
+		return NULL;
+	for(k=0; k<nboxes; k++)
+		len += strlen(boxes[k].text) + 1;
+	text = nmalloc(len);
+	strcpy(text, boxes[0].text);
+	for(k=1; k<nboxes; k++)
+	{
+		strcat(text, "\f");
+		strcat(text, boxes[k].text);
+	}
+	return text;
+}
+
+/* Stack the boxes in the middle of the screen, a line apart, and mark
+   where they ended up in cover and shadow. Everything's worked out
+   from the screen size, so it's the same at startup and after any
+   resize to that size. */
+void overlay_place(void)
+{
+	int i, j, k, y, h = -1;
+
+	memset(cover, 0, ncols * LINES * sizeof(uint16_t));
+	for(k=0; k<nboxes; k++)
+		h += boxes[k].nlines + 1;
+	y = LINES > h ? (LINES - h + 1) / 2 : 0;
+
+	for(k=0; k<nboxes; k++)
+	{
+		mtx_box *b = &boxes[k];
+
+		b->y = y;
+		b->x = COLS > b->width ? (COLS - b->width) / 2 : 0;
+		y += b->nlines + 1;
+		/* only every other screen col has a matrix col. */
+		for(j=(b->x + 1)/2; j<ncols && j*2 < b->x + b->width; j++)
+			for(i=b->y; i<LINES && i < b->y + b->nlines; i++)
+			{
+				cover[j * LINES + i] = 0xffff;
+				shadow[j * LINES + i] = MTX_CELL_COVERED;
+			}
+	}
+	overlay_shown = 0;
+}
+
+/* Put the boxes on screen, cut off at its edges. */
+void overlay_draw(void)
+{
+	int i, k;
+
+	for(k=0; k<nboxes; k++)
+	{
+		mtx_box *b = &boxes[k];
+		int w = b->x + b->width > COLS ? COLS - b->x : b->width;
+
+		for(i=0; i<b->nlines && b->y + i < LINES; i++)
+		{
+			char *line = b->lines[i], c = line[w];
+
+			line[w] = 0;
+			out->draw_str(b->y + i, b->x, line, 0);
+			line[w] = c;
+		}
+	}
+	overlay_shown = 1;
+}
+
+/* Initialize the global variables. Cols that were already there keep
+   going, at the same size, and only new ones start from scratch. */
+void var_init()
+{
+	int i, j, old_lines = var_lines;
+	int keep = ncols < (COLS+1) / 2 ? ncols : (COLS+1) / 2;
+
+	/* every col starts at its top from here on. */
+	for(j=0; j<keep; j++)
+		col_unroll(j, old_lines);
+
+	ncols = (COLS+1) / 2;
+	var_lines = LINES;
+	seg_max = (LINES+1)/2 + 1;
+
+	if(ncols > arena_cols || LINES > arena_lines)
+		arena_grow(keep, old_lines);
+	/* it fits, so the cols only need to move up or down in matrix.
+	   going from the end, when they get longer, means none of them
+	   gets written over before it's moved. */
+	else if(LINES < old_lines)
+	{
+		for(j=0; j<keep; j++)
+			memmove(matrix + j * LINES, matrix + j * old_lines, LINES);
+	}
+	else if(LINES > old_lines)
+	{
+		for(j=keep-1; j>=0; j--)
+		{
+			memmove(matrix + j * LINES, matrix + j * old_lines, old_lines);
+			memset(matrix + j * LINES + old_lines, MTX_BLANK, LINES - old_lines);
+		}
 	}
 
-	for(i=0; i<COLS; i+=2)
-	{
-		/* Set up spaces[] array of how many spaces to skip */
-		spaces[i] = (int) rand_func() % LINES + 1;
+	/* last drawn frame. the screen always gets cleared along with
+	   this, so nothing needs to be drawn where it stays blank. */
+	memset(shadow, 0, ncols * LINES * sizeof(uint16_t));
+
+	for(j=0; j<ncols; j++)
+	{
+		uint8_t *col = matrix + j * LINES;
+
+		if(j < keep)
+		{
+			/* where the streams ended up, for both kinds of scrolling. */
+			for(i=0; i<LINES && col[i] != MTX_BLANK; i++)
+				;
+			run[j] = i;
+			find_segs(j);
+			continue;
+		}
+
+		memset(col, MTX_BLANK, LINES);
+		rng_seed(&rngs[j]);
+
+		/* Set up spaces[] array of how many spaces to skip */
+		spaces[j] = rng_range(&rngs[j], LINES) + 1;
+
+		/* And length of the stream */
+		length[j] = rng_range(&rngs[j], LINES/2) + 3;
+
+		/* And how fast it moves with -a: 3/4, 1/2 or 1/4 of frames. */
+		col_period[j] = (4 << 16) / (3 - rng_range(&rngs[j], 3));
+		col_due[j] = (band_tick << 16) + col_period[j];
+
+		offset[j] = 0;
+		run[j] = 0;
+		nsegs[j] = 0;
+	}
+
+	/* share the cols out between the bands. */
+	for(i=0; i<nthreads; i++)
+	{
+		int per = (ncols + nthreads - 1) / nthreads;
+		bands[i].j0 = i * per < ncols ? i * per : ncols;
+		bands[i].j1 = bands[i].j0 + per < ncols ? bands[i].j0 + per : ncols;
+	}
+	wheel_build();
+	overlay_place();
+}
+
+/* Switch between old and new style scrolling, fixing up the cols
+   for whichever one is being switched to. */
+void toggle_old_scroll()
+{
+	int i, j;
+
+	flags ^= MTX_FLAG_OLD;
+
+	/* old-style only needs to know how long the top streams are. */
+	if(flags & MTX_FLAG_OLD)
+	{
+		for(j=0; j<ncols; j++)
+		{
+			uint8_t *col = matrix + j * LINES;
+			for(i=0; i<LINES && col[i] != MTX_BLANK; i++)
+				;
+			run[j] = i;
+		}
+		return;
+	}
+
+	/* new-style wants every col to start at the top of its cells
+	   again, and to know where its streams are. */
+	for(j=0; j<ncols; j++)
+	{
+		col_unroll(j, LINES);
+		find_segs(j);
+	}
+}
+
+short rand_char(mtx_rng *r)
+{
+	return rng_range(r, randmax - randmin) + randmin;
+}
+
+#ifndef _WIN32
+void sighandler(int s)
+{
+	signal_status = s;
+}
+#endif
+
+/* Frames start every -u * 10ms, however long the last one took. */
+uint64_t frame_deadline = 0; /* when the next frame should start. */
+
+/* Work out when the frame after this one starts, which is period
+   after this one was meant to. Returns 1 if we're already past it. */
+int frame_next(uint64_t period)
+{
+	uint64_t now = now_ns();
+
+	/* -u 0 is as fast as possible. */
+	if(!period)
+	{
+		frame_deadline = now;
+		return 0;
+	}
+
+	frame_deadline += period;
+	if(now > frame_deadline)
+	{
+		stats.late++;
+		/* too far behind to catch up, so start over from now. */
+		if(now - frame_deadline > period)
+			frame_deadline = now;
+		return 1;
+	}
+	return 0;
+}
+
+/* --control's clients, and the longest line they can send. */
+#define CTL_CLIENTS 8
+#define CTL_LINE 256
+
+#ifdef HAVE_POLL_H
+/* Everything we wait on between frames: keys, then signals
+   and the frame timer if we can have them as fds, then --control's
+   socket and clients. */
+struct pollfd events[4 + CTL_CLIENTS];
+int nevents = 0;
+int signal_fd = -1, timer_fd = -1;
+
+/* Keys come from in. Signals we care about go to signal_fd
+   instead of a handler, so they can't slip in before a wait. */
+void events_init(int in)
+{
+#ifdef HAVE_SYS_SIGNALFD_H
+	sigset_t set;
+#endif
+
+	/* a key on anything but a tty would wake us all the time. */
+	events[nevents].fd = isatty(in) ? in : -1;
+	events[nevents++].events = POLLIN;
+
+#ifdef HAVE_SYS_SIGNALFD_H
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGQUIT);
+	sigaddset(&set, SIGWINCH);
+	sigaddset(&set, SIGTSTP);
+	sigprocmask(SIG_BLOCK, &set, NULL);
+	signal_fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if(signal_fd == -1)
+		sigprocmask(SIG_UNBLOCK, &set, NULL);
+	else
+	{
+		events[nevents].fd = signal_fd;
+		events[nevents++].events = POLLIN;
+	}
+#endif
+	/* without signalfd, the handlers cut poll() short instead. */
+	if(signal_fd == -1)
+	{
+		signal(SIGINT, sighandler);
+		signal(SIGQUIT, sighandler);
+		signal(SIGWINCH, sighandler);
+		signal(SIGTSTP, sighandler);
+	}
+
+#ifdef HAVE_SYS_TIMERFD_H
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(timer_fd != -1)
+	{
+		events[nevents].fd = timer_fd;
+		events[nevents++].events = POLLIN;
+	}
+#endif
+}
+#endif
+
+/* Sleep until the next frame is due, or a key or signal comes in.
+   Returns 1 if it's time for the frame. With frames stopped, there's
+   no next frame, so only a key or signal wakes us up. */
+int event_wait(int stopped)
+{
+#ifdef HAVE_POLL_H
+	int timeout = -1, i;
+	uint64_t now = now_ns();
+
+	if(stopped)
+	{
+#ifdef HAVE_SYS_TIMERFD_H
+		struct itimerspec its;
+
+		/* all zeros disarms it. */
+		memset(&its, 0, sizeof(its));
+		if(timer_fd != -1)
+			timerfd_settime(timer_fd, 0, &its, NULL);
+#endif
+		/* the -t ttys still need looking at for resizes. */
+		if(nttys)
+			timeout = 500;
+	}
+	else if(now >= frame_deadline)
+		timeout = 0; /* just look, the frame's due already. */
+#ifdef HAVE_SYS_TIMERFD_H
+	else if(timer_fd != -1)
+	{
+		struct itimerspec its;
+
+		memset(&its, 0, sizeof(its));
+		its.it_value.tv_sec = frame_deadline / 1000000000ULL;
+		its.it_value.tv_nsec = frame_deadline % 1000000000ULL;
+		timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+	}
+#endif
+	else
+		timeout = (frame_deadline - now + 999999) / 1000000;
+
+	if(poll(events, nevents, timeout) > 0)
+	{
+		/* a tty that's hung up (-t doesn't get a SIGHUP for its
+		   own) would wake us straight away from now on. */
+		if(events[0].revents & (POLLHUP | POLLERR | POLLNVAL))
+			events[0].fd = -1;
+		for(i=1; i<nevents; i++)
+		{
+			if(!(events[i].revents & POLLIN))
+				continue;
+#ifdef HAVE_SYS_SIGNALFD_H
+			if(events[i].fd == signal_fd)
+			{
+				struct signalfd_siginfo si;
+				while(read(signal_fd, &si, sizeof(si)) == sizeof(si))
+					signal_status = si.ssi_signo;
+			}
+#endif
+#ifdef HAVE_SYS_TIMERFD_H
+			if(events[i].fd == timer_fd)
+			{
+				uint64_t expirations;
+				if(read(timer_fd, &expirations, sizeof(expirations)) < 0)
+					continue;
+			}
+#endif
+		}
+	}
+	return !stopped && now_ns() >= frame_deadline;
+#else
+	uint64_t now = now_ns();
+
+	/* nothing to wait on keys with, so just look every so often. */
+	if(stopped)
+	{
+		napms(100);
+		return 0;
+	}
+	if(now < frame_deadline)
+	{
+#ifdef HAVE_CLOCK_NANOSLEEP
+		struct timespec ts;
+
+		ts.tv_sec = frame_deadline / 1000000000ULL;
+		ts.tv_nsec = frame_deadline % 1000000000ULL;
+		/* signals cut it short, so they get dealt with straight away. */
+		clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+#else
+		napms((frame_deadline - now) / 1000000);
+#endif
+	}
+	return 1;
+#endif
+}
+
+#ifndef _WIN32
+int size_fd = -1; /* the curses tty, for finding out its size. */
+#endif
+
+void resize_screen(void)
+{
+#ifdef _WIN32
+	BOOL result;
+	HANDLE hStdHandle;
+	CONSOLE_SCREEN_BUFFER_INFO csbiInfo;
+
+	hStdHandle = GetStdHandle(STD_OUTPUT_HANDLE);
+	if(hStdHandle == INVALID_HANDLE_VALUE)
+		return;
+
+	result = GetConsoleScreenBufferInfo(hStdHandle, &csbiInfo);
+	if(!result)
+		return;
+	LINES = csbiInfo.dwSize.Y;
+	COLS = csbiInfo.dwSize.X;
+#else
+	char *tty;
+	int result = 0;
+	struct winsize win;
+
+	/* get size of tty. */
+	if(flags & MTX_FLAG_ANSI)
+	{
+		if(!ansi_size())
+			return;
+	}
+	else
+	{
+		/* opened the first time, and kept for next time. */
+		if(size_fd == -1)
+		{
+			tty = ttyname(0);
+			if (!tty)
+				return;
+			size_fd = open(tty, O_RDWR | O_NOCTTY);
+			if (size_fd == -1)
+				return;
+		}
+		result = ioctl(size_fd, TIOCGWINSZ, &win);
+		if (result == -1)
+			return;
+
+		COLS = win.ws_col;
+		LINES = win.ws_row;
+	}
+#endif
+
+	/* reset to minimums. */
+	if(LINES < 10)
+		LINES = 10;
+	if(COLS < 10)
+		COLS = 10;
+
+	/* resize to larger window if needed. */
+#ifdef HAVE_RESIZETERM
+	if(!(flags & MTX_FLAG_ANSI))
+	{
+		resizeterm(LINES, COLS);
+#ifdef HAVE_WRESIZE
+		if(wresize(stdscr, LINES, COLS) == ERR)
+			c_die("Cannot resize window!\n");
+#endif /* HAVE_WRESIZE */
+	}
+#endif /* HAVE_RESIZETERM */
+
+	/* realloc everything for new size. */
+	var_init();
+	/* Do this because width may have changed... the matrix goes
+	   back on along with it, so it's never blank in between. */
+	out->clear_screen();
+}
+
+/* Every glyph as the bytes that put it on screen, so drawing a
+   cell is one copy instead of working it out every time. */
+typedef struct
+{
+	char bytes[7]; /* nul terminated, for addstr. */
+	uint8_t len;
+} mtx_glyph;
+
+mtx_glyph glyphs[256];
+uint32_t glyphs_flags = ~0U; /* what glyphs was filled in for. */
+
+/* Fill in glyphs for -c, -l and -x. lambdas are a glyph of their own,
+   so -m doesn't need it redone. */
+void glyphs_init(void)
+{
+	int i;
+
+	if(glyphs_flags == (flags & (MTX_FLAG_UNICODE | MTX_FLAG_LINUX | MTX_FLAG_XWINDOW)))
+		return;
+	glyphs_flags = flags & (MTX_FLAG_UNICODE | MTX_FLAG_LINUX | MTX_FLAG_XWINDOW);
+
+	memset(glyphs, 0, sizeof(glyphs));
+	for(i=0; i<256; i++)
+	{
+		mtx_glyph *g = &glyphs[i];
+
+		if(!i)
+			g->bytes[0] = ' ';
+#ifdef HAVE_NCURSESW_NCURSES_H
+		else if(i == MTX_GLYPH_LAMBDA)
+			strcpy(g->bytes, "λ");
+		else if((flags & MTX_FLAG_UNICODE) && i < CHARS_LEN)
+			strcpy(g->bytes, chars_array[i]);
+		/* essentially, with utf-8, you aren't
+		   able to print 8-bit chars. you have
+		   to print utf-8 strings. */
+		/* this scheme also doesn't seem to work
+		   in the linux console, but that's not
+		   surprising, as utf-8 in general doesn't
+		   seem to work there. it does work with
+		   xterm, though. */
+		else if(flags & (MTX_FLAG_LINUX | MTX_FLAG_XWINDOW))
+		{
+			g->bytes[0] = 0xC0 | ((i & 0xC0) >> 6);
+			g->bytes[1] = 0x80 | (i & 0x3F);
+		}
+#endif
+		else
+			g->bytes[0] = i;
+		g->len = strlen(g->bytes);
+	}
+}
+
+/* Work out how matrix value v should look on screen. h is the glyph
+   a head would get in its spot, and color is already shifted into
+   place. bold and lambda are constants in each of the kernels below,
+   so this comes out as straight-line code, with no branches. */
+static inline uint16_t cell_make(unsigned v, unsigned h, unsigned color, const int bold, const int lambda)
+{
+	unsigned is_head = -(unsigned)(v == MTX_HEAD);
+	unsigned is_char = -(unsigned)(v != MTX_HEAD && v != MTX_BLANK);
+	unsigned cell = (lambda ? MTX_GLYPH_LAMBDA : v) | color;
+
+	/* heads get a char derived from their position instead of a
+	   fresh rand_char() every frame. kind of a hack, but it's
+	   needed to reduce load, and keeps heads from being redrawn. */
+	h |= COLOR_WHITE << MTX_CELL_COLOR_SHIFT;
+	if(bold)
+		h |= MTX_CELL_BOLD;
+	if(bold == MTX_FLAG_BOLD_ALL)
+		cell |= MTX_CELL_BOLD;
+	else if(bold == MTX_FLAG_BOLD_SOME)
+		cell |= (v & 1) * MTX_CELL_BOLD;
+
+	return (cell & is_char) | (h & is_head);
+}
+
+/* Terminals like xterm can say when they gain and lose focus, as
+   ESC [ I and ESC [ O. focus_fd is where to ask them, -1 if nowhere. */
+int focus_fd = -1;
+int focused = 1;
+
+void focus_report(int on)
+{
+#ifndef _WIN32
+	if(focus_fd < 0)
+		return;
+	if(write(focus_fd, on ? "\033[?1004h" : "\033[?1004l", 8) < 0)
+		focus_fd = -1;
+#endif
+}
+
+/* Bytes read after an ESC that turned out not to be a focus report,
+   handed out before anything new. */
+int key_ahead[2], key_at = 0, key_n = 0;
+
+/* The next key from out, with focus reports taken out and everything
+   else just as it was typed. ERR if there's nothing. */
+int get_key(void)
+{
+	int c;
+
+	if(key_at < key_n)
+		return key_ahead[key_at++];
+	while((c = out->get_key()) == 27)
+	{
+		key_at = key_n = 0;
+		if((c = out->get_key()) != ERR)
+			key_ahead[key_n++] = c;
+		if(c == '[' && (c = out->get_key()) != ERR)
+			key_ahead[key_n++] = c;
+		if(key_n < 2 || (c != 'I' && c != 'O'))
+			return 27;
+		focused = c == 'I';
+		key_n = 0;
+	}
+	return c;
+}
+
+/* === curses backend === */
+
+/* Turn MTX_CELL_* attrs into curses ones. */
+attr_t curses_attrs(uint16_t attrs)
+{
+	attr_t r = COLOR_PAIR((attrs & MTX_CELL_COLOR) >> MTX_CELL_COLOR_SHIFT);
+
+	if(attrs & MTX_CELL_BOLD)
+		r |= A_BOLD;
+	return r;
+}
+
+void curses_draw_cell(int y, int x, uint16_t cell)
+{
+	int glyph = cell & MTX_CELL_GLYPH;
+	attr_t attrs = curses_attrs(cell);
+
+#ifndef HAVE_NCURSESW_NCURSES_H
+	if(flags & (MTX_FLAG_LINUX | MTX_FLAG_XWINDOW))
+		attrs |= A_ALTCHARSET;
+#endif
+	attrset(attrs);
+	move(y, x);
+
+#ifdef HAVE_NCURSESW_NCURSES_H
+	addstr(glyphs[glyph].bytes);
+#else
+	/* the alt charset needs the char as is. */
+	addch(glyph ? glyph : ' ');
+#endif
+}
+
+void curses_draw_str(int y, int x, const char *str, uint16_t attrs)
+{
+	attrset(curses_attrs(attrs));
+	mvaddstr(y, x, str);
+	attrset(A_NORMAL);
+}
+
+/* getch() also redraws the screen, because curses is weird, so the
+   main loop leaves that to it. this is for when nothing is read, like
+   rand_pre_init()'s message going up a letter at a time. */
+void curses_flush(void)
+{
+	refresh();
+}
+
+int curses_get_key(void)
+{
+	return getch();
+}
+
+void curses_clear(void)
+{
+	clear();
+}
+
+void curses_stop(void)
+{
+	focus_report(0);
+	curs_set(1);
+	clear();
+	refresh();
+	resetty();
+	endwin();
+}
+
+mtx_backend curses_backend = {curses_draw_cell, curses_draw_str, curses_flush, curses_get_key, curses_clear, curses_stop};
+
+#ifndef _WIN32
+/* === ansi backend ===
+   builds each frame as escape codes in one buffer,
+   and hands it to the terminal with a single write(). */
+
+ansi_frag ansi_main = {NULL, 0, 0, -1, -1, MTX_CELL_INVALID, NULL, NULL, 0, 0, NULL, 0};
+uint64_t ansi_bytes = 0; /* everything ever flushed. */
+#ifdef HAVE_TERMIOS_H
+struct termios ansi_saved; /* to put the tty back on exit. */
+int ansi_have_saved = 0;
+#endif
+
+/* Make room for n more bytes. */
+void ansi_reserve(ansi_frag *f, size_t n)
+{
+	if(f->len + n <= f->cap)
+		return;
+	while(f->len + n > f->cap)
+		f->cap = f->cap ? f->cap * 2 : 4096;
+	f->buf = nrealloc(f->buf, f->cap);
+}
+
+void ansi_put(ansi_frag *f, const char *str, size_t n)
+{
+	ansi_reserve(f, n);
+	memcpy(f->buf + f->len, str, n);
+	f->len += n;
+}
+
+/* for string literals, so nobody has to count escape codes by hand. */
+#define ansi_puts(f, str) ansi_put(f, str, sizeof(str) - 1)
+
+/* snprintf is way too slow for this. */
+void ansi_put_num(ansi_frag *f, int n)
+{
+	char digits[12];
+	int i = sizeof(digits);
+
+	do
+	{
+		digits[--i] = '0' + n % 10;
+		n /= 10;
+	} while(n);
+	ansi_put(f, digits + i, sizeof(digits) - i);
+}
+
+void ansi_move(ansi_frag *f, int y, int x)
+{
+	if(y == f->y && x == f->x)
+		return;
+
+	/* moving right on the same line is shorter than an absolute move. */
+	if(y == f->y && x > f->x && f->x >= 0)
+	{
+		ansi_puts(f, "\033[");
+		ansi_put_num(f, x - f->x);
+		ansi_puts(f, "C");
+	}
+	else
+	{
+		ansi_puts(f, "\033[");
+		ansi_put_num(f, y + 1);
+		ansi_puts(f, ";");
+		ansi_put_num(f, x + 1);
+		ansi_puts(f, "H");
+	}
+	f->y = y;
+	f->x = x;
+}
+
+/* How far a trail fades: level 0 is the color itself, and the last is
+   the dimmest. 15 of them, so a cell never comes out as
+   MTX_CELL_INVALID. */
+#define FADE_LEVELS 15
+
+/* The SGR parameter for each color at each fade level, made once by
+   ansi_colors_init() so setting attrs is only a copy. */
+typedef struct
+{
+	char bytes[19]; /* "38;2;255;255;255" is the longest. */
+	uint8_t len;
+	uint8_t same; /* first one with the same bytes, as the cube is coarse. */
+} ansi_color;
+
+#define ansi_color_n(attrs) ((((attrs) & MTX_CELL_FADE) >> (MTX_CELL_FADE_SHIFT - 3)) | \
+	(((attrs) & MTX_CELL_COLOR) >> MTX_CELL_COLOR_SHIFT))
+ansi_color ansi_colors[FADE_LEVELS << 3];
+
+/* Level 0 is the plain 3x colors, which every terminal has. The rest
+   are 24-bit if $COLORTERM says the terminal does them, and from the
+   256 color cube if not. */
+void ansi_colors_init(void)
+{
+	/* the curses colors, in their order. 0 is the terminal's default,
+	   which we can only guess at. */
+	static const uint8_t rgb[8][3] =
+	{
+		{192, 192, 192}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0},
+		{0, 0, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255}
+	};
+	const char *ct = getenv("COLORTERM");
+	int truecolor = ct && (!strcmp(ct, "truecolor") || !strcmp(ct, "24bit"));
+	int c, l, k;
+
+	for(l=0; l<FADE_LEVELS; l++)
+		for(c=0; c<8; c++)
+		{
+			ansi_color *a = &ansi_colors[(l << 3) | c];
+			/* down to a fifth of the color at the end of the trail. */
+			int scale = 256 - l * 204 / (FADE_LEVELS - 1);
+			int v[3];
+
+			for(k=0; k<3; k++)
+				v[k] = rgb[c][k] * scale >> 8;
+			if(!l)
+				snprintf(a->bytes, sizeof(a->bytes), "3%d", c ? c : 9);
+			else if(truecolor)
+				snprintf(a->bytes, sizeof(a->bytes), "38;2;%d;%d;%d", v[0], v[1], v[2]);
+			else
+			{
+				/* the cube's steps are 0, 95, 135, 175, 215 and 255. */
+				for(k=0; k<3; k++)
+					v[k] = v[k] < 48 ? 0 : v[k] < 115 ? 1 : (v[k] - 35) / 40;
+				snprintf(a->bytes, sizeof(a->bytes), "38;5;%d", 16 + v[0] * 36 + v[1] * 6 + v[2]);
+			}
+			a->len = strlen(a->bytes);
+			for(k=0; strcmp(ansi_colors[k].bytes, a->bytes); k++)
+				;
+			a->same = k;
+		}
+}
+
+void ansi_set_attrs(ansi_frag *f, uint16_t attrs)
+{
+	const ansi_color *c = &ansi_colors[ansi_color_n(attrs)];
+	int recolor;
+
+	if(attrs == f->attrs)
+		return;
+	if(f->attrs == MTX_CELL_INVALID)
+	{
+		ansi_puts(f, "\033[0");
+		if(attrs & MTX_CELL_BOLD)
+			ansi_puts(f, ";1");
+		/* pair 0 is the terminal's default colors, same as curses. */
+		if(attrs & (MTX_CELL_COLOR | MTX_CELL_FADE))
+		{
+			ansi_puts(f, ";");
+			ansi_put(f, c->bytes, c->len);
+		}
+		ansi_puts(f, "m");
+	}
+	else
+	{
+		/* only change what's different. */
+		recolor = c->same != ansi_colors[ansi_color_n(f->attrs)].same;
+		if(!recolor && !((attrs ^ f->attrs) & MTX_CELL_BOLD))
+		{
+			f->attrs = attrs;
+			return;
+		}
+		ansi_puts(f, "\033[");
+		if((attrs ^ f->attrs) & MTX_CELL_BOLD)
+		{
+			if(attrs & MTX_CELL_BOLD)
+				ansi_puts(f, "1");
+			else
+				ansi_puts(f, "22");
+			if(recolor)
+				ansi_puts(f, ";");
+		}
+		if(recolor)
+			ansi_put(f, c->bytes, c->len);
+		ansi_puts(f, "m");
+	}
+	f->attrs = attrs;
+}
+
+/* Forget where the terminal is, for when something else wrote to it. */
+void ansi_forget(ansi_frag *f)
+{
+	f->y = f->x = -1;
+	f->attrs = MTX_CELL_INVALID;
+}
+
+void ansi_put_cell(ansi_frag *f, int y, int x, uint16_t cell)
+{
+	const mtx_glyph *g = &glyphs[cell & MTX_CELL_GLYPH];
+
+	ansi_move(f, y, x);
+	ansi_set_attrs(f, cell & ~MTX_CELL_GLYPH);
+
+	/* copying all of bytes is quicker than copying just len of them. */
+	ansi_reserve(f, sizeof(g->bytes));
+	memcpy(f->buf + f->len, g->bytes, sizeof(g->bytes));
+	f->len += g->len;
+
+	/* the last col leaves the cursor in limbo, waiting to wrap. */
+	if(++f->x >= COLS)
+		f->x = -1;
+}
+
+/* Draw a cell later, with the rest of them, in ansi_emit(). */
+void ansi_queue_cell(ansi_frag *f, int y, int x, uint16_t cell)
+{
+	ansi_cell *c;
+
+	if(f->ncells == f->cells_cap)
+	{
+		f->cells_cap = f->cells_cap ? f->cells_cap * 2 : 1024;
+		f->cells = nrealloc(f->cells, f->cells_cap * sizeof(ansi_cell));
+		f->sorted = nrealloc(f->sorted, f->cells_cap * sizeof(ansi_cell));
+	}
+	c = &f->cells[f->ncells++];
+	c->y = y;
+	c->x = x;
+	c->cell = cell;
+}
+
+/* bold and color as 0 to 15, and the fade level above that. */
+#define ansi_attrs_n(cell) (((cell) & ~MTX_CELL_GLYPH) >> MTX_CELL_COLOR_SHIFT)
+
+/* Turn the queued cells into escape codes: everything with the same
+   attrs together, starting with the ones the terminal has now, so attrs
+   only change when they have to, and each line left to right within
+   that, so moves can be short ones. cells come in a col at a time, so
+   a counting sort on attrs and line leaves them left to right. */
+void ansi_emit(ansi_frag *f)
+{
+	size_t i, n = f->ncells, nstarts;
+	uint32_t sum = 0;
+	int a, cur, nattrs = 16;
+
+	if(!n)
+		return;
+	/* only --fade goes past 16, so only sort on as many as there are. */
+	for(i=0; i<n; i++)
+		if(ansi_attrs_n(f->cells[i].cell) >= nattrs)
+			nattrs = ansi_attrs_n(f->cells[i].cell) + 1;
+	nstarts = nattrs * LINES + 1;
+	if(f->nstarts < nstarts)
+	{
+		f->starts = nrealloc(f->starts, nstarts * sizeof(uint32_t));
+		f->nstarts = nstarts;
+	}
+	memset(f->starts, 0, nstarts * sizeof(uint32_t));
+	for(i=0; i<n; i++)
+		f->starts[ansi_attrs_n(f->cells[i].cell) * LINES + f->cells[i].y + 1]++;
+	for(i=1; i<nstarts; i++)
+		f->starts[i] = sum += f->starts[i];
+	for(i=0; i<n; i++)
+		f->sorted[f->starts[ansi_attrs_n(f->cells[i].cell) * LINES + f->cells[i].y]++] = f->cells[i];
+	f->ncells = 0;
+
+	/* starts[k] is now where key k+1 starts, so attrs a are from
+	   starts[a*LINES - 1] up to starts[(a+1)*LINES - 1]. */
+	cur = f->attrs == MTX_CELL_INVALID ? 0 : ansi_attrs_n(f->attrs);
+	if(cur >= nattrs)
+		cur = 0;
+	for(a=cur; a<cur + nattrs; a++)
+	{
+		int k = a % nattrs;
+		size_t from = k ? f->starts[k * LINES - 1] : 0;
+		size_t to = f->starts[(k + 1) * LINES - 1];
+
+		for(i=from; i<to; i++)
+			ansi_put_cell(f, f->sorted[i].y, f->sorted[i].x, f->sorted[i].cell);
+	}
+}
+
+void ansi_draw_cell(int y, int x, uint16_t cell)
+{
+	ansi_queue_cell(&ansi_main, y, x, cell);
+}
+
+void ansi_draw_str(int y, int x, const char *str, uint16_t attrs)
+{
+	/* the matrix goes under it, not on top. */
+	ansi_emit(&ansi_main);
+	ansi_move(&ansi_main, y, x);
+	ansi_set_attrs(&ansi_main, attrs);
+	ansi_put(&ansi_main, str, strlen(str));
+	/* not worth counting utf-8 widths to find out where it ended up. */
+	ansi_main.y = ansi_main.x = -1;
+}
+
+/* With --threads, the bands' parts of the frame go out at ansi_mark,
+   after what was already waiting when the frame started. */
+int ansi_nfrags = 0;
+size_t ansi_mark = 0;
+
+/* --cast and --ttyrec write each flushed frame to a file instead,
+   along with when it would have been shown. */
+#define EXPORT_CAST 1
+#define EXPORT_TTYREC 2
+FILE *export_file = NULL;
+int export_format = 0;
+uint64_t export_us = 0;     /* when the next frame goes, in the clip. */
+uint64_t export_period = 0; /* us between frames. */
+
+void export_open(char *path, int format)
+{
+	if(!strcmp(path, "-"))
+		export_file = stdout;
+	else if(!(export_file = fopen(path, "wb")))
+		c_die("'%s' couldn't be opened: %s\n", path, strerror(errno));
+	export_format = format;
+	if(format == EXPORT_CAST)
+		fprintf(export_file, "{\"version\": 2, \"width\": %d, \"height\": %d, \"timestamp\": %lld}\n",
+		        COLS, LINES, (long long) time(NULL));
+}
+
+/* asciicast wants everything as a json string. */
+void export_json(const char *str, size_t len)
+{
+	size_t i, start = 0;
+
+	for(i=0; i<len; i++)
+	{
+		unsigned char c = str[i];
+		if(c >= 0x20 && c != '"' && c != '\\')
+			continue;
+		fwrite(str + start, 1, i - start, export_file);
+		if(c == '"' || c == '\\')
+			fprintf(export_file, "\\%c", c);
+		else
+			fprintf(export_file, "\\u%04x", c);
+		start = i + 1;
+	}
+	fwrite(str + start, 1, len - start, export_file);
+}
+
+void export_frame(struct iovec *iov, int n)
+{
+	size_t len = 0;
+	int i;
+
+	for(i=0; i<n; i++)
+		len += iov[i].iov_len;
+
+	/* a frame where nothing moved is just a longer gap. */
+	if(len && export_format == EXPORT_CAST)
+	{
+		fprintf(export_file, "[%.6f, \"o\", \"", export_us / 1e6);
+		for(i=0; i<n; i++)
+			export_json(iov[i].iov_base, iov[i].iov_len);
+		fputs("\"]\n", export_file);
+	}
+	else if(len)
+	{
+		unsigned char head[12];
+		uint32_t v[3];
+		int j;
+
+		v[0] = export_us / 1000000;
+		v[1] = export_us % 1000000;
+		v[2] = len;
+		for(j=0; j<12; j++)
+			head[j] = v[j / 4] >> (j % 4 * 8);
+		fwrite(head, 1, 12, export_file);
+		for(i=0; i<n; i++)
+			fwrite(iov[i].iov_base, 1, iov[i].iov_len, export_file);
+	}
+	if(ferror(export_file))
+		c_die("Couldn't write the clip: %s\n", strerror(errno));
+	export_us += export_period;
+}
+
+/* === -t more than once ===
+   every frame is still only encoded once, and the same bytes go to
+   every tty. each one takes them at its own pace: whatever it can't
+   take yet waits in its own queue, so a slow one only holds itself up.
+   if it gets too far behind its queue is thrown away, and once it's
+   caught up it gets the whole screen over again. */
+void tty_open(mtx_tty *t)
+{
+	t->fd = open(t->name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if(t->fd == -1)
+	{
+		fprintf(stderr, "cmatrix: '%s' couldn't be opened: %s\n", t->name, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+/* Write what t can take without waiting, 0 if it's all gone out. */
+size_t tty_push(mtx_tty *t)
+{
+	while(t->q.len > t->q_off)
+	{
+		ssize_t done = write(t->fd, t->q.buf + t->q_off, t->q.len - t->q_off);
+		if(done < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				/* hung up, most likely. the rest can do without it. */
+				close(t->fd);
+				t->fd = -1;
+				t->q.len = 0;
+			}
+			break;
+		}
+		t->q_off += done;
+	}
+	if(t->q_off == t->q.len)
+		t->q.len = t->q_off = 0;
+	return t->q.len - t->q_off;
+}
+
+/* The whole screen as it should be now, for a tty that fell behind.
+   The boxes go out again with the next frame, to every tty. */
+void tty_repaint(mtx_tty *t)
+{
+	int i, j;
+
+	ansi_puts(&t->q, "\033[0m\033[2J");
+	ansi_forget(&t->q);
+	for(j=0; j<ncols; j++)
+		for(i=0; i<LINES; i++)
+		{
+			uint16_t cell = shadow[j * LINES + i];
+			if(cell != MTX_CELL_INVALID && cell != MTX_CELL_COVERED)
+				ansi_queue_cell(&t->q, i, j*2, cell);
+		}
+	ansi_emit(&t->q);
+	t->stale = 0;
+	overlay_shown = 0;
+	/* the next frame can't count on where this left the terminal. */
+	ansi_forget(&ansi_main);
+}
+
+void tty_fanout(struct iovec *iov, int n)
+{
+	int i, k;
+
+	for(k=0; k<nttys; k++)
+	{
+		mtx_tty *t = &ttys[k];
+		size_t len = 0;
+		ssize_t done = 0;
+
+		if(t->fd < 0)
+			continue;
+		/* CAN ends whatever escape code got cut off, and once
+		   there's room for it there's room for the rest. */
+		if(t->stale)
+		{
+			if(write(t->fd, "\030", 1) == 1)
+			{
+				tty_repaint(t);
+				tty_push(t);
+			}
+			continue;
+		}
+
+		for(i=0; i<n; i++)
+			len += iov[i].iov_len;
+		/* straight from the frame if it's keeping up, */
+		if(!tty_push(t))
+		{
+			if(t->fd < 0)
+				continue;
+			while((done = writev(t->fd, iov, n)) < 0 && errno == EINTR)
+				;
+			if(done < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				close(t->fd);
+				t->fd = -1;
+				continue;
+			}
+			if(done < 0)
+				done = 0;
+		}
+		/* and anything left over waits its turn. */
+		if(t->q.len - t->q_off + len - done > TTY_BACKLOG)
+		{
+			t->q.len = t->q_off = 0;
+			t->stale = 1;
+			continue;
+		}
+		for(i=0; i<n; i++)
+		{
+			if((size_t) done >= iov[i].iov_len)
+			{
+				done -= iov[i].iov_len;
+				continue;
+			}
+			ansi_put(&t->q, (char *) iov[i].iov_base + done, iov[i].iov_len - done);
+			done = 0;
+		}
+	}
+}
+
+void ansi_flush(void)
+{
+	struct iovec iov[MAX_THREADS + 2], *v = iov;
+	int i, n = 0;
+
+	ansi_emit(&ansi_main);
+	if(ansi_nfrags)
+	{
+		iov[n].iov_base = ansi_main.buf;
+		iov[n++].iov_len = ansi_mark;
+		for(i=0; i<ansi_nfrags; i++)
+		{
+			iov[n].iov_base = bands[i].frag.buf;
+			iov[n++].iov_len = bands[i].frag.len;
+			bands[i].frag.len = 0;
+		}
+		iov[n].iov_base = ansi_main.buf + ansi_mark;
+		iov[n++].iov_len = ansi_main.len - ansi_mark;
+		ansi_nfrags = 0;
+		ansi_mark = 0;
+	}
+	else
+	{
+		iov[n].iov_base = ansi_main.buf;
+		iov[n++].iov_len = ansi_main.len;
+	}
+	ansi_main.len = 0;
+
+	for(i=0; i<n; i++)
+		ansi_bytes += iov[i].iov_len;
+	if(export_file)
+		export_frame(iov, n);
+	if(nttys)
+	{
+		tty_fanout(iov, n);
+		return;
+	}
+	/* --bench only wants to know how much there was. */
+	if(ansi_out < 0)
+		return;
+
+	while(n > 0)
+	{
+		ssize_t done = writev(ansi_out, v, n);
+		if(done < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+		/* skip what got written, which may end partway into one. */
+		while(n > 0 && (size_t) done >= v->iov_len)
+		{
+			done -= v->iov_len;
+			v++;
+			n--;
+		}
+		if(n > 0)
+		{
+			v->iov_base = (char *) v->iov_base + done;
+			v->iov_len -= done;
+		}
+	}
+}
+
+int ansi_get_key(void)
+{
+	unsigned char c;
+
+	/* the tty is set to return straight away when there's nothing. */
+	if(read(ansi_in, &c, 1) == 1)
+		return c;
+	return ERR;
+}
+
+void ansi_clear(void)
+{
+	ansi_emit(&ansi_main);
+	ansi_puts(&ansi_main, "\033[0m\033[2J");
+	ansi_main.attrs = 0;
+	ansi_main.y = ansi_main.x = -1;
+}
+
+#ifdef HAVE_TERMIOS_H
+/* No echo, and reads return straight away. 1 if saved is worth putting back. */
+int ansi_raw(int fd, struct termios *saved)
+{
+	struct termios t;
+
+	if(tcgetattr(fd, saved) != 0)
+		return 0;
+	t = *saved;
+	t.c_lflag &= ~(ICANON | ECHO);
+	t.c_iflag &= ~ICRNL;
+	t.c_cc[VMIN] = 0;
+	t.c_cc[VTIME] = 0;
+	tcsetattr(fd, TCSANOW, &t);
+	return 1;
+}
+#endif
+
+/* Take over the terminal: alternate screen, no cursor, no echo. */
+void ansi_start(void)
+{
+#ifdef HAVE_TERMIOS_H
+	int k;
+
+	/* keys only come from the first tty, but none of them should echo. */
+	for(k=0; k<nttys; k++)
+		ttys[k].have_saved = ansi_raw(ttys[k].fd, &ttys[k].saved);
+	if(!nttys)
+		ansi_have_saved = ansi_raw(ansi_in, &ansi_saved);
+#endif
+	ansi_puts(&ansi_main, "\033[?1049h\033[?25l");
+	/* the other ttys' focus reports would never get read. */
+	if(!nttys)
+		ansi_puts(&ansi_main, "\033[?1004h");
+	ansi_clear();
+}
+
+void ansi_stop(void)
+{
+	int i, k;
+
+	/* a clip just ends with its last frame. */
+	if(export_file)
+	{
+		fflush(export_file);
+		export_file = NULL;
+	}
+	ansi_main.len = 0;
+	ansi_main.ncells = 0;
+	ansi_nfrags = 0;
+	ansi_mark = 0;
+	/* a tty that's behind doesn't get a whole screen just to clear it. */
+	for(k=0; k<nttys; k++)
+		if(ttys[k].stale)
+		{
+			ttys[k].q.len = ttys[k].q_off = 0;
+			ttys[k].stale = 0;
+			ansi_puts(&ttys[k].q, "\030");
+		}
+	ansi_puts(&ansi_main, "\033[0m\033[2J\033[?25h\033[?1049l");
+	if(!nttys && ansi_out >= 0)
+		ansi_puts(&ansi_main, "\033[?1004l");
+	ansi_flush();
+	/* give slow ttys a moment to take the rest, but not forever. */
+	for(i=0; i<100; i++)
+	{
+		size_t left = 0;
+		for(k=0; k<nttys; k++)
+			if(ttys[k].fd >= 0)
+				left += tty_push(&ttys[k]);
+		if(!left)
+			break;
+		napms(1);
+	}
+#ifdef HAVE_TERMIOS_H
+	for(k=0; k<nttys; k++)
+		if(ttys[k].fd >= 0 && ttys[k].have_saved)
+			tcsetattr(ttys[k].fd, TCSANOW, &ttys[k].saved);
+	if(ansi_have_saved)
+		tcsetattr(ansi_in, TCSANOW, &ansi_saved);
+#endif
+}
+
+mtx_backend ansi_backend = {ansi_draw_cell, ansi_draw_str, ansi_flush, ansi_get_key, ansi_clear, ansi_stop};
+#endif /* !_WIN32 */
+
+/* Move col j along one line. */
+static inline void col_update(int j, const int old, const int changes)
+{
+	uint8_t *col = matrix + j * LINES;
+	mtx_rng *r = rngs + j;
+	int i, k, y, z;
+
+	/* old-style (real) scrolling. */
+	if(old)
+	{
+		/* scroll the whole column down, by moving its top up
+		   one cell. the new top takes the old bottom's place. */
+		offset[j] = offset[j] ? offset[j] - 1 : LINES - 1;
+
+		/* create new column. */
+		if(!run[j])
+		{
+			/* fill gap with blanks. */
+			if(spaces[j]>0)
+			{
+				col[offset[j]] = MTX_BLANK;
+				spaces[j]--;
+			}
+			else
+			{
+				/* Random number to determine whether head of next collumn
+				   of chars has a white 'head' on it. */
+				if(rng_range(r, 3) == 1)
+					col[offset[j]] = MTX_HEAD;
+				else
+					col[offset[j]] = rand_char(r);
+				length[j] = rng_range(r, LINES/2) + 3;
+				spaces[j] = rng_range(r, LINES) + 1;
+			}
+		}
+		/* fill in column. */
+		else if(run[j] <= length[j])
+			col[offset[j]] = rand_char(r);
+		/* create gap. */
+		else
+			col[offset[j]] = MTX_BLANK;
+
+		/* keep track of the stream at the top. */
+		if(col[offset[j]] == MTX_BLANK)
+			run[j] = 0;
+		else if(run[j] < LINES)
+			run[j]++;
+	}
+	/* new-style (fake) scrolling. */
+	else
+	{
+		mtx_seg *seg = segs + j * seg_max;
+		int n = nsegs[j], top, end;
+
+		/* last column is done growing. */
+		if(!n || seg[0].top > 0)
+		{
+			if(spaces[j] > 0)
+				spaces[j]--;
+			/* create new column. */
+			else
+			{
+				length[j] = rng_range(r, LINES/2) + 3;
+				col[0] = MTX_HEAD;
+				spaces[j] = rng_range(r, LINES) + 1;
+
+				/* with no gap, it's part of the stream below. */
+				if(n && seg[0].top == 1)
+					seg[0].top = 0;
+				else
+				{
+					memmove(seg + 1, seg, n * sizeof(mtx_seg));
+					seg[0].top = 0;
+					seg[0].end = 1;
+					n++;
+				}
+			}
+		}
+
+		/* move each stream along, only touching its ends.
+		   z is where the streams that are left get put. */
+		for(i = z = 0; i < n; i++)
+		{
+			top = seg[i].top;
+			end = seg[i].end;
+			y = end - top;
+
+			if(changes)
+			{
+				for(k = top; k < end; k++)
+					if(rng_next(r) < 0x20000000) /* 1 in 8. */
+						col[k] = rand_char(r);
+			}
+
+			/* replace old head with normal char. */
+			if(col[end-1] == MTX_HEAD)
+				col[end-1] = rand_char(r);
+
+			/* create new head. */
+			if(end < LINES)
+				col[end++] = MTX_HEAD;
+
+			/* If we're at the top of the column and it's reached its
+			   full length (about to start moving down), we do this
+			   to get it moving.  All the streams below the first one
+			   are already moving, so they always lose their tail. */
+			if(y > length[j] || i > 0)
+				col[top++] = MTX_BLANK;
+
+			/* drop streams that have gone off the bottom. */
+			if(top < end)
+			{
+				seg[z].top = top;
+				seg[z].end = end;
+				z++;
+			}
+		}
+		nsegs[j] = z;
+	}
+}
+
+/* Move band b's cols along, if it's their turn. */
+static inline void matrix_update_with(mtx_band *b, const int old, const int changes, const int async)
+{
+	int j, next, *slot;
+
+	if(!async)
+	{
+		for(j=b->j0; j<b->j1; j++)
+			col_update(j, old, changes);
+		return;
+	}
+
+	/* only the cols in this frame's slot, and the slow ones in it
+	   might still have to go round again. */
+	slot = &b->wheel[band_tick % WHEEL_SLOTS];
+	j = *slot;
+	*slot = -1;
+	for(; j != -1; j = next)
+	{
+		next = col_next[j];
+		if((int32_t) (col_due[j] - ((band_tick + 1) << 16)) < 0)
+		{
+			col_update(j, old, changes);
+			col_due[j] += col_period[j];
+		}
+		wheel_add(b, j);
+	}
+}
+
+/* cell, or MTX_CELL_COVERED if mask says a box is over it. */
+static inline uint16_t cell_cover(uint16_t cell, uint16_t mask)
+{
+	return (cell & ~mask) | (MTX_CELL_COVERED & mask);
+}
+
+/* With --fade, how far line i is from the head of its stream, as
+   cell bits. segs run top to bottom, and i only ever goes down, so
+   *seg moves on to the next one when i goes past the end of it. step
+   is FADE_LEVELS over *seg's length, in 16.16 fixed point. */
+static inline unsigned seg_fade(const mtx_seg **seg, const mtx_seg *last, unsigned *step, int i)
+{
+	if(*seg < last && (*seg)->end <= i && ++*seg < last)
+		*step = (FADE_LEVELS << 16) / ((*seg)->end - (*seg)->top);
+	if(*seg == last)
+		return 0;
+	/* lines outside of it are blanks, whatever this says. */
+	return (((*seg)->end - 1 - i) * *step >> 16) << MTX_CELL_FADE_SHIFT;
+}
+
+/* Draw band b's cols, only touching cells that changed since last frame. */
+static inline void matrix_draw_with(int mcolor, mtx_band *b, const int bold, const int lambda, const int rainbow, const int fade)
+{
+	int i, j, n;
+	unsigned range = randmax - randmin;
+
+	for(j=b->j0; j<b->j1; j++)
+	{
+		uint8_t *col = matrix + j * LINES;
+		uint16_t *drawn = shadow + j * LINES;
+		const uint16_t *mask = cover + j * LINES;
+		/* rainbow gives each col its own color. */
+		unsigned color = (rainbow ? color_vals[j % 6] : mcolor) << MTX_CELL_COLOR_SHIFT;
+		unsigned h = (j*2) % range;
+		const uint8_t *v = col + offset[j];
+		const mtx_seg *seg = segs + j * seg_max, *last = seg + nsegs[j];
+		unsigned step = fade && seg < last ? (FADE_LEVELS << 16) / (seg->end - seg->top) : 0;
+
+		/* line 0 is kept at offset[j], only not 0 with -o, so
+		   go to the end of the ring and then round from its start. */
+		for(i = 0, n = LINES - offset[j]; i < LINES; v = col, n = LINES)
+			for(; i < n; i++, v++)
+			{
+				unsigned f = fade ? seg_fade(&seg, last, &step, i) : 0;
+				uint16_t cell = cell_cover(cell_make(*v, h + randmin, color | f, bold, lambda), mask[i]);
+
+				h++;
+				h -= range & -(unsigned)(h == range);
+				if(drawn[i] == cell)
+					continue;
+				drawn[i] = cell;
+#ifndef _WIN32
+				if(band_frags)
+					ansi_queue_cell(&b->frag, i, j*2, cell);
+				else
+#endif
+					out->draw_cell(i, j*2, cell);
+				b->cells++;
+			}
+	}
+}
+
+/* Work out how band b's cols should look, into dst, laid out like
+   matrix, for something else to draw later. */
+static inline void matrix_compose_with(int mcolor, mtx_band *b, uint16_t *dst, const int bold, const int lambda, const int rainbow, const int fade)
+{
+	int i, j, n;
+	unsigned range = randmax - randmin;
+
+	for(j=b->j0; j<b->j1; j++)
+	{
+		uint8_t *col = matrix + j * LINES;
+		uint16_t *cells = dst + j * LINES;
+		const uint16_t *mask = cover + j * LINES;
+		unsigned color = (rainbow ? color_vals[j % 6] : mcolor) << MTX_CELL_COLOR_SHIFT;
+		unsigned h = (j*2) % range;
+		const uint8_t *v = col + offset[j];
+		const mtx_seg *seg = segs + j * seg_max, *last = seg + nsegs[j];
+		unsigned step = fade && seg < last ? (FADE_LEVELS << 16) / (seg->end - seg->top) : 0;
+
+		for(i = 0, n = LINES - offset[j]; i < LINES; v = col, n = LINES)
+			for(; i < n; i++, v++)
+			{
+				unsigned f = fade ? seg_fade(&seg, last, &step, i) : 0;
+
+				cells[i] = cell_cover(cell_make(*v, h + randmin, color | f, bold, lambda), mask[i]);
+				h++;
+				h -= range & -(unsigned)(h == range);
+			}
+	}
+}
+
+/* The kernels: a copy of update, draw and compose for each mix of the
+   flags they look at, so none of them test flags as they go. Each
+   list entry is (bold, lambda, rainbow, fade) or (old, changes, async),
+   in the order kernels_select() indexes them. */
+#define MTX_DRAW_KERNELS(K) \
+	K(0, 0, 0, 0) K(0, 0, 0, 1) K(0, 0, 1, 0) K(0, 0, 1, 1) \
+	K(0, 1, 0, 0) K(0, 1, 0, 1) K(0, 1, 1, 0) K(0, 1, 1, 1) \
+	K(1, 0, 0, 0) K(1, 0, 0, 1) K(1, 0, 1, 0) K(1, 0, 1, 1) \
+	K(1, 1, 0, 0) K(1, 1, 0, 1) K(1, 1, 1, 0) K(1, 1, 1, 1) \
+	K(2, 0, 0, 0) K(2, 0, 0, 1) K(2, 0, 1, 0) K(2, 0, 1, 1) \
+	K(2, 1, 0, 0) K(2, 1, 0, 1) K(2, 1, 1, 0) K(2, 1, 1, 1)
+
+#define MTX_UPDATE_KERNELS(K) \
+	K(0, 0, 0) K(0, 0, 1) K(0, 1, 0) K(0, 1, 1) \
+	K(1, 0, 0) K(1, 0, 1) K(1, 1, 0) K(1, 1, 1)
+
+#define MTX_DRAW_KERNEL(bold, lambda, rainbow, fade) \
+	void matrix_draw_##bold##lambda##rainbow##fade(int mcolor, mtx_band *b) \
+	{ matrix_draw_with(mcolor, b, bold, lambda, rainbow, fade); } \
+	void matrix_compose_##bold##lambda##rainbow##fade(int mcolor, mtx_band *b, uint16_t *dst) \
+	{ matrix_compose_with(mcolor, b, dst, bold, lambda, rainbow, fade); }
+
+#define MTX_UPDATE_KERNEL(old, changes, async) \
+	void matrix_update_##old##changes##async(mtx_band *b) \
+	{ matrix_update_with(b, old, changes, async); }
+
+MTX_DRAW_KERNELS(MTX_DRAW_KERNEL)
+MTX_UPDATE_KERNELS(MTX_UPDATE_KERNEL)
+
+/* paused, nothing moves. */
+void matrix_update_paused(mtx_band *b)
+{
+	(void)b;
+}
+
+typedef struct
+{
+	void (*draw)(int mcolor, mtx_band *b);
+	void (*compose)(int mcolor, mtx_band *b, uint16_t *dst);
+} mtx_draw_kernel;
+
+#define MTX_DRAW_ENTRY(bold, lambda, rainbow, fade) \
+	{matrix_draw_##bold##lambda##rainbow##fade, matrix_compose_##bold##lambda##rainbow##fade},
+#define MTX_UPDATE_ENTRY(old, changes, async) \
+	matrix_update_##old##changes##async,
+
+mtx_draw_kernel draw_kernels[] = { MTX_DRAW_KERNELS(MTX_DRAW_ENTRY) };
+void (*update_kernels[])(mtx_band *b) = { MTX_UPDATE_KERNELS(MTX_UPDATE_ENTRY) };
+
+/* What the frame loop calls, picked by kernels_select(). */
+void (*matrix_update)(mtx_band *b);
+void (*matrix_draw)(int mcolor, mtx_band *b);
+void (*matrix_compose)(int mcolor, mtx_band *b, uint16_t *dst);
+
+#define KERNEL_FLAGS (MTX_FLAG_BOLD | MTX_FLAG_LAMBDA | MTX_FLAG_RAINBOW | MTX_FLAG_FADE | \
+	MTX_FLAG_OLD | MTX_FLAG_CHANGES | MTX_FLAG_ASYNC | MTX_FLAG_PAUSE)
+uint32_t kernel_flags = ~0U; /* what the kernels were picked for. */
+
+/* Pick the kernels for flags, if any flag they depend on has changed. */
+void kernels_select(void)
+{
+	int d, u;
+
+	if(kernel_flags == (flags & KERNEL_FLAGS))
+		return;
+	kernel_flags = flags & KERNEL_FLAGS;
+
+	d = (flags & MTX_FLAG_BOLD) * 8 + ((flags & MTX_FLAG_RAINBOW) != 0) * 2;
+#ifdef HAVE_NCURSESW_NCURSES_H
+	d += ((flags & MTX_FLAG_LAMBDA) != 0) * 4;
+#endif
+	/* -o has no streams to go by, so its trails don't fade. */
+	if((flags & (MTX_FLAG_FADE | MTX_FLAG_OLD)) == MTX_FLAG_FADE)
+		d++;
+	matrix_draw = draw_kernels[d].draw;
+	matrix_compose = draw_kernels[d].compose;
+
+	u = ((flags & MTX_FLAG_OLD) != 0) * 4 + ((flags & MTX_FLAG_CHANGES) != 0) * 2 + ((flags & MTX_FLAG_ASYNC) != 0);
+	matrix_update = (flags & MTX_FLAG_PAUSE) ? matrix_update_paused : update_kernels[u];
+	/* -a's wheels don't turn while they're not being used. */
+	if((flags & (MTX_FLAG_ASYNC | MTX_FLAG_PAUSE)) == MTX_FLAG_ASYNC)
+		wheel_build();
+}
+
+/* What the bands are doing this frame. */
+int band_color; /* -1 is don't draw. */
+uint16_t *band_dst = NULL; /* compose into here instead of drawing. */
+
+void band_run(mtx_band *b)
+{
+	uint64_t t0 = now_ns(), t1;
+
+	matrix_update(b);
+	t1 = now_ns();
+	b->update_ns = t1 - t0;
+	b->draw_ns = 0;
+	b->cells = 0;
+	if(band_color >= 0)
+	{
+#ifndef _WIN32
+		/* other bands' output comes between ours. */
+		ansi_forget(&b->frag);
+#endif
+		if(band_dst)
+			matrix_compose(band_color, b, band_dst);
+		else
+		{
+			matrix_draw(band_color, b);
+#ifndef _WIN32
+			ansi_emit(&b->frag);
+#endif
+		}
+		b->draw_ns = now_ns() - t1;
+	}
+}
+
+#ifdef HAVE_PTHREAD_H
+pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t pool_go = PTHREAD_COND_INITIALIZER;
+pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+uint64_t pool_frame = 0; /* goes up by one to start a frame. */
+int pool_left = 0;       /* threads still busy with it. */
+
+void *band_thread(void *arg)
+{
+	mtx_band *b = arg;
+	uint64_t seen = 0;
+
+	pthread_mutex_lock(&pool_lock);
+	while(1)
+	{
+		while(pool_frame == seen)
+			pthread_cond_wait(&pool_go, &pool_lock);
+		seen = pool_frame;
+		pthread_mutex_unlock(&pool_lock);
+
+		band_run(b);
+
+		pthread_mutex_lock(&pool_lock);
+		if(--pool_left == 0)
+			pthread_cond_signal(&pool_done);
+	}
+	return NULL;
+}
+
+/* Band 0 is done by the main thread, the rest get one each. */
+void bands_start(void)
+{
+	int i, err;
+
+	for(i=1; i<nthreads; i++)
+	{
+		err = pthread_create(&bands[i].thread, NULL, band_thread, &bands[i]);
+		if(err)
+			c_die("Couldn't start thread: %s\n", strerror(err));
+	}
+}
+#endif
+
+/* Move the whole matrix along, and draw it too if mcolor isn't -1. */
+void bands_run(int mcolor)
+{
+	band_tick++;
+	band_color = mcolor;
+#ifdef HAVE_PTHREAD_H
+	if(nthreads > 1)
+	{
+		pthread_mutex_lock(&pool_lock);
+		pool_frame++;
+		pool_left = nthreads - 1;
+		pthread_cond_broadcast(&pool_go);
+		pthread_mutex_unlock(&pool_lock);
+	}
+#endif
+	band_run(&bands[0]);
+#ifdef HAVE_PTHREAD_H
+	if(nthreads > 1)
+	{
+		pthread_mutex_lock(&pool_lock);
+		while(pool_left)
+			pthread_cond_wait(&pool_done, &pool_lock);
+		pthread_mutex_unlock(&pool_lock);
+	}
+#endif
+}
+
+/* The 'f' key's frame stats, in the top right corner. */
+#define HUD_LINES 7
+#define HUD_WIDTH 20
+char hud_text[HUD_LINES][HUD_WIDTH+1];
+mtx_stats hud_last; /* stats when hud_text was last worked out. */
+uint64_t hud_when = 0;
+
+void hud_line(int i, char *name, double value, char *unit)
+{
+	snprintf(hud_text[i], HUD_WIDTH+1, " %-7s%8.0f %-3s", name, value, unit);
+}
+
+/* Work out the averages since last time, twice a second. */
+void hud_update(uint64_t now)
+{
+	double frames = stats.frames - hud_last.frames;
+
+	if(hud_when && now - hud_when < 500000000ULL)
+		return;
+
+	if(!hud_when || !frames)
+		frames = 1;
+	hud_line(0, "fps", hud_when ? frames * 1e9 / (now - hud_when) : 0, "");
+	hud_line(1, "update", (stats.update_ns - hud_last.update_ns) / frames / 1e3, "us");
+	hud_line(2, "draw", (stats.draw_ns - hud_last.draw_ns) / frames / 1e3, "us");
+	hud_line(3, "flush", (stats.flush_ns - hud_last.flush_ns) / frames / 1e3, "us");
+#ifndef _WIN32
+	if(flags & MTX_FLAG_ANSI)
+		hud_line(4, "output", (stats.bytes - hud_last.bytes) / frames, "B");
+	else
+#endif
+		snprintf(hud_text[4], HUD_WIDTH+1, " %-7s%8s %-3s", "output", "?", "B");
+	hud_line(5, "cells", (stats.cells - hud_last.cells) / frames, "");
+	hud_line(6, "late", stats.late - hud_last.late, "");
+
+	hud_last = stats;
+	hud_when = now;
+}
+
+void hud_draw(char text[][HUD_WIDTH+1])
+{
+	int i;
+
+	if(COLS < HUD_WIDTH || LINES < HUD_LINES)
+		return;
+	for(i=0; i<HUD_LINES; i++)
+		out->draw_str(i, COLS - HUD_WIDTH, text[i], 0);
+}
+
+/* Blank out where the stats were, and have the matrix and any boxes
+   drawn there again. */
+void hud_hide(void)
+{
+	static char blank[HUD_WIDTH+1];
+	int i, j;
+
+	if(COLS < HUD_WIDTH || LINES < HUD_LINES)
+		return;
+	memset(blank, ' ', HUD_WIDTH);
+	for(i=0; i<HUD_LINES; i++)
+	{
+		out->draw_str(i, COLS - HUD_WIDTH, blank, 0);
+		for(j=(COLS - HUD_WIDTH + 1)/2; j<ncols; j++)
+			if(!cover[j * LINES + i])
+				shadow[j * LINES + i] = MTX_CELL_INVALID;
+	}
+	overlay_shown = 0;
+}
+
+#ifdef HAVE_SYS_UN_H
+/* === --control ===
+   a unix socket for changing things and reading the stats without a
+   keyboard. each line sent to it is a command, and gets a line back.
+   commands turn into the keys that do the same thing, so they go
+   through the same switch in the main loop. nothing here ever waits:
+   a client that can't take its answer gets hung up on. */
+typedef struct
+{
+	int fd; /* -1 if the slot is free. */
+	char buf[CTL_LINE]; /* what's come in of a line so far. */
+	size_t len;
+} ctl_client;
+
+char *ctl_path = NULL;
+int ctl_fd = -1;
+ctl_client ctl_clients[CTL_CLIENTS];
+char ctl_keys[64]; /* for the main loop, one per call to control_key(). */
+int ctl_nkeys = 0, ctl_key_at = 0;
+uint64_t ctl_fps_when = 0, ctl_fps_frames = 0; /* where fps is counted from. */
+double ctl_fps = 0;
+
+/* the keys for each of color_vals. */
+char ctl_color_keys[NUM_COLORS] = {'@', '!', '$', '#', '^', '%', '&'};
+
+/* Wake event_wait() up when fd has something. */
+void control_watch(int fd)
+{
+#ifdef HAVE_POLL_H
+	if(nevents)
+	{
+		events[nevents].fd = fd;
+		events[nevents++].events = POLLIN;
+	}
+#endif
+}
+
+void control_unwatch(int fd)
+{
+#ifdef HAVE_POLL_H
+	int i;
+
+	for(i=1; i<nevents; i++)
+		if(events[i].fd == fd)
+		{
+			events[i] = events[--nevents];
+			break;
+		}
+#endif
+}
+
+void control_close(void)
+{
+	int i;
+
+	if(ctl_fd == -1)
+		return;
+	for(i=0; i<CTL_CLIENTS; i++)
+		if(ctl_clients[i].fd != -1)
+			close(ctl_clients[i].fd);
+	close(ctl_fd);
+	unlink(ctl_path);
+	ctl_fd = -1;
+}
+
+void control_open(char *path)
+{
+	struct sockaddr_un sa;
+	int i;
+
+	if(strlen(path) >= sizeof(sa.sun_path))
+		c_die("'%s' is too long for a socket.\n", path);
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+
+	ctl_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(ctl_fd == -1)
+		c_die("socket: %s\n", strerror(errno));
+	if(bind(ctl_fd, (struct sockaddr *) &sa, sizeof(sa)) == -1)
+	{
+		/* one left behind by an instance that's gone is fair game,
+		   but not one that's still answering. */
+		int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+
+		if(errno != EADDRINUSE || probe == -1
+		   || connect(probe, (struct sockaddr *) &sa, sizeof(sa)) == 0
+		   || errno != ECONNREFUSED || unlink(path) == -1
+		   || bind(ctl_fd, (struct sockaddr *) &sa, sizeof(sa)) == -1)
+			c_die("'%s' couldn't be used for --control: %s\n", path, strerror(errno));
+		close(probe);
+	}
+	if(listen(ctl_fd, CTL_CLIENTS) == -1)
+		c_die("listen: %s\n", strerror(errno));
+	fcntl(ctl_fd, F_SETFL, fcntl(ctl_fd, F_GETFL) | O_NONBLOCK);
+	fcntl(ctl_fd, F_SETFD, FD_CLOEXEC);
+
+	ctl_path = path;
+	for(i=0; i<CTL_CLIENTS; i++)
+		ctl_clients[i].fd = -1;
+	ctl_fps_when = now_ns();
+	control_watch(ctl_fd);
+	/* however we exit, the socket shouldn't outlive us. */
+	atexit(control_close);
+}
+
+void control_hangup(ctl_client *c)
+{
+	control_unwatch(c->fd);
+	close(c->fd);
+	c->fd = -1;
+}
+
+void control_reply(ctl_client *c, const char *fmt, ...)
+{
+	char line[128];
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(line, sizeof(line) - 1, fmt, ap);
+	va_end(ap);
+	if(n < 0 || n > (int) sizeof(line) - 2)
+		n = sizeof(line) - 2;
+	line[n++] = '\n';
+	if(send(c->fd, line, n, MSG_NOSIGNAL) != n)
+		control_hangup(c);
+}
+
+/* Frames per second since fps was last counted, at least a second ago. */
+void control_fps(uint64_t now)
+{
+	if(now - ctl_fps_when < 1000000000ULL)
+		return;
+	ctl_fps = (stats.frames - ctl_fps_frames) * 1e9 / (now - ctl_fps_when);
+	ctl_fps_when = now;
+	ctl_fps_frames = stats.frames;
+}
+
+/* Resident set size in bytes, or -1 if there's no telling. */
+long long control_rss(void)
+{
+	long long pages, resident;
+	FILE *f = fopen("/proc/self/statm", "r");
+	int n;
+
+	if(!f)
+		return -1;
+	n = fscanf(f, "%lld %lld", &pages, &resident);
+	fclose(f);
+	return n == 2 ? resident * sysconf(_SC_PAGESIZE) : -1;
+}
+
+void control_key_add(int key)
+{
+	if(ctl_nkeys < (int) sizeof(ctl_keys))
+		ctl_keys[ctl_nkeys++] = key;
+}
+
+/* Press key if the flag isn't how arg wants it: "on", "off", or
+   nothing to flip it, same as the key. */
+int control_toggle(const char *arg, uint32_t flag, int key)
+{
+	if(!*arg || (!strcmp(arg, "on") && !(flags & flag)) || (!strcmp(arg, "off") && (flags & flag)))
+		control_key_add(key);
+	else if(strcmp(arg, "on") && strcmp(arg, "off"))
+		return 0;
+	return 1;
+}
+
+void control_command(ctl_client *c, char *line)
+{
+	char cmd[16] = "", arg[16] = "";
+	int i, ok = 1;
+
+	if(sscanf(line, "%15s %15s", cmd, arg) < 1)
+		return;
+
+	/* the ones that change things. */
+	if(!strcmp(cmd, "speed"))
+	{
+		ok = strlen(arg) == 1 && arg[0] >= '0' && arg[0] <= '9';
+		if(ok)
+			control_key_add(arg[0]);
+	}
+	else if(!strcmp(cmd, "color"))
+	{
+		for(i=0; i<NUM_COLORS && strcmp(arg, color_names[i]); i++)
+			;
+		ok = i < NUM_COLORS;
+		if(ok)
+			control_key_add(ctl_color_keys[i]);
+	}
+	else if(!strcmp(cmd, "bold"))
+	{
+		if(!strcmp(arg, "none"))
+			control_key_add('n');
+		else if(!strcmp(arg, "some"))
+			control_key_add('b');
+		else if(!strcmp(arg, "all"))
+			control_key_add('B');
+		else
+			ok = 0;
+	}
+	else if(!strcmp(cmd, "pause"))
+		ok = control_toggle(arg, MTX_FLAG_PAUSE, 'p');
+	else if(!strcmp(cmd, "rainbow"))
+		ok = control_toggle(arg, MTX_FLAG_RAINBOW, 'r');
+	else if(!strcmp(cmd, "async"))
+		ok = control_toggle(arg, MTX_FLAG_ASYNC, 'a');
+	/* and the ones that ask. */
+	else if(!strcmp(cmd, "frames"))
+	{
+		control_reply(c, "frames %llu", (unsigned long long) stats.frames);
+		return;
+	}
+	else if(!strcmp(cmd, "fps"))
+	{
+		control_fps(now_ns());
+		control_reply(c, "fps %.1f", ctl_fps);
+		return;
+	}
+	else if(!strcmp(cmd, "bytes"))
+	{
+		/* curses doesn't say. */
+		control_reply(c, "bytes %lld", (flags & MTX_FLAG_ANSI) ? (long long) stats.bytes : -1LL);
+		return;
+	}
+	else if(!strcmp(cmd, "late"))
+	{
+		control_reply(c, "late %llu", (unsigned long long) stats.late);
+		return;
+	}
+	else if(!strcmp(cmd, "rss"))
+	{
+		control_reply(c, "rss %lld", control_rss());
+		return;
+	}
+	else
+	{
+		control_reply(c, "error unknown command '%s'", cmd);
+		return;
+	}
+
+	if(ok)
+		control_reply(c, "ok");
+	else
+		control_reply(c, "error bad argument '%s' for %s", arg, cmd);
+}
+
+/* Take anything new on the socket, and hand back the next key it
+   asked for, or ERR. */
+int control_key(void)
+{
+	int i, fd;
+
+	if(ctl_fd == -1)
+		return ERR;
+	if(ctl_key_at < ctl_nkeys)
+		return ctl_keys[ctl_key_at++];
+	ctl_key_at = ctl_nkeys = 0;
+	control_fps(now_ns());
+
+	while((fd = accept(ctl_fd, NULL, NULL)) != -1)
+	{
+		for(i=0; i<CTL_CLIENTS && ctl_clients[i].fd != -1; i++)
+			;
+		if(i == CTL_CLIENTS)
+		{
+			close(fd);
+			continue;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		ctl_clients[i].fd = fd;
+		ctl_clients[i].len = 0;
+		control_watch(fd);
+	}
+
+	for(i=0; i<CTL_CLIENTS; i++)
+	{
+		ctl_client *c = &ctl_clients[i];
+		ssize_t n;
+		char *nl;
+
+		if(c->fd == -1)
+			continue;
+		n = read(c->fd, c->buf + c->len, sizeof(c->buf) - 1 - c->len);
+		if(n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+		{
+			control_hangup(c);
+			continue;
+		}
+		if(n < 0)
+			continue;
+		c->len += n;
+		c->buf[c->len] = 0;
+		while(c->fd != -1 && (nl = strchr(c->buf, '\n')))
+		{
+			*nl = 0;
+			control_command(c, c->buf);
+			c->len -= nl + 1 - c->buf;
+			memmove(c->buf, nl + 1, c->len + 1);
+		}
+		/* a line that doesn't fit isn't a command. */
+		if(c->fd != -1 && c->len == sizeof(c->buf) - 1)
+		{
+			control_reply(c, "error line too long");
+			if(c->fd != -1)
+				control_hangup(c);
+		}
+	}
+
+	return ctl_key_at < ctl_nkeys ? ctl_keys[ctl_key_at++] : ERR;
+}
+#endif /* HAVE_SYS_UN_H */
+
+#ifdef USE_PIPELINE
+/* === --pipeline ===
+   the main thread moves the matrix along and works out how every cell
+   should look, and hands that to the render thread, which diffs it
+   against the screen and writes it out. it only ever shows the newest
+   frame, so a slow terminal loses frames instead of holding up the
+   matrix. */
+
+/* three frames: the one the main thread is filling in, the newest
+   one that's done, and the one being shown. handing a frame over swaps
+   it with the newest, and so does picking it up, so neither thread
+   ever waits for the other and there's always the newest to pick up. */
+#define PIPE_SLOTS 3
+#define PIPE_NEW 4 /* in pipe_newest, when nobody's picked it up yet. */
+typedef struct
+{
+	uint16_t *cells; /* laid out like matrix, from matrix_compose(). */
+	size_t size;     /* room in cells. */
+	uint64_t seq;    /* how many frames were handed over before this. */
+	mtx_stats shown; /* pipe_stats, once this was shown. */
+	int hud; /* 'f', with hud_text as it was. */
+	char hud_text[HUD_LINES][HUD_WIDTH+1];
+} mtx_frame;
+
+mtx_frame pipe_ring[PIPE_SLOTS];
+int pipe_back = 0;  /* the main thread's. */
+int pipe_front = 1; /* the render thread's. */
+atomic_int pipe_newest = 2;
+uint64_t pipe_sent = 0;  /* frames handed over. */
+atomic_ullong pipe_done = 0; /* frames up to and including the last shown. */
+int pipe_wake[2]; /* a byte down here means there's a new frame. */
+pthread_t pipe_thread;
+uint64_t pipe_dropped = 0; /* frames the render thread never showed. */
+/* the render thread's frames, cells, draw_ns, flush_ns and bytes. only
+   it touches these, and they get to stats by way of the frames. */
+mtx_stats pipe_stats;
+
+/* Take the render thread's counts from s, if they're newer than the
+   ones stats already has. */
+void pipe_collect(const mtx_stats *s)
+{
+	static uint64_t shown = 0; /* frames it had shown, as of those. */
+
+	if(s->frames <= shown)
+		return;
+	shown = s->frames;
+	stats.cells = s->cells;
+	stats.draw_ns = s->draw_ns;
+	stats.flush_ns = s->flush_ns;
+	stats.bytes = s->bytes;
+}
+
+/* The frame to fill in next. It's been shown, or dropped, since
+   we last had it, and brings the render thread's counts back. */
+mtx_frame *pipe_next(void)
+{
+	mtx_frame *f = &pipe_ring[pipe_back];
+
+	pipe_collect(&f->shown);
+	if(f->size < (size_t) ncols * LINES)
+	{
+		free(f->cells);
+		f->size = ncols * LINES;
+		f->cells = nmalloc(f->size * sizeof(uint16_t));
+	}
+	return f;
+}
+
+/* Hand over the frame pipe_next() gave us. */
+void pipe_publish(void)
+{
+	pipe_ring[pipe_back].seq = pipe_sent++;
+	pipe_back = atomic_exchange(&pipe_newest, pipe_back | PIPE_NEW) & ~PIPE_NEW;
+	/* if the pipe's full, it's already awake. */
+	if(write(pipe_wake[1], "", 1) < 0)
+		return;
+}
+
+/* Wait for the render thread to show the last frame it was given, so
+   nothing else is writing to the terminal or using the screen state. */
+void pipe_drain(void)
+{
+	/* the render thread leaves flags alone, it's the main thread's. */
+	if(pthread_equal(pthread_self(), pipe_thread) || !(flags & MTX_FLAG_PIPELINE))
+		return;
+	while(atomic_load(&pipe_done) != pipe_sent)
+		napms(1);
+}
+
+void pipe_show(mtx_frame *f)
+{
+	static int hud = 0; /* whether the stats are on screen. */
+	uint64_t t0 = now_ns(), t1, cells = 0;
+	int i, j;
+
+	if(hud && !f->hud)
+		hud_hide();
+	hud = f->hud;
+
+	for(j=0; j<ncols; j++)
+	{
+		uint16_t *drawn = shadow + j * LINES;
+		uint16_t *cell = f->cells + j * LINES;
+
+		for(i=0; i<LINES; i++)
+		{
+			if(drawn[i] == cell[i])
+				continue;
+			drawn[i] = cell[i];
+			ansi_queue_cell(&ansi_main, i, j*2, cell[i]);
+			cells++;
+		}
+	}
+
+	if(!overlay_shown)
+		overlay_draw();
+	if(f->hud)
+		hud_draw(f->hud_text);
+
+	t1 = now_ns();
+	ansi_flush();
+
+	/* the main thread leaves these to us. */
+	pipe_stats.frames++;
+	pipe_stats.cells += cells;
+	pipe_stats.draw_ns += t1 - t0;
+	pipe_stats.flush_ns += now_ns() - t1;
+	pipe_stats.bytes = ansi_bytes;
+	f->shown = pipe_stats;
+}
+
+void *pipe_render(void *arg)
+{
+	uint64_t shown = 0;
+	char buf[64];
+
+	(void) arg;
+	while(1)
+	{
+		if(!(atomic_load(&pipe_newest) & PIPE_NEW))
+		{
+			if(read(pipe_wake[0], buf, sizeof(buf)) < 0 && errno != EINTR)
+				return NULL;
+			continue;
+		}
+
+		pipe_front = atomic_exchange(&pipe_newest, pipe_front) & ~PIPE_NEW;
+		pipe_dropped += pipe_ring[pipe_front].seq - shown;
+		pipe_show(&pipe_ring[pipe_front]);
+		shown = pipe_ring[pipe_front].seq + 1;
+		atomic_store(&pipe_done, shown);
+	}
+	return NULL;
+}
+
+void pipe_clear(void)
+{
+	pipe_drain();
+	ansi_clear();
+}
+
+void pipe_stop(void)
+{
+	pipe_drain();
+	ansi_stop();
+}
+
+/* Same as the ansi backend, except for waiting on the render thread
+   first. drawing from the main thread is only for before it starts. */
+mtx_backend pipe_backend = {ansi_draw_cell, ansi_draw_str, ansi_flush, ansi_get_key, pipe_clear, pipe_stop};
+
+void pipe_start(void)
+{
+	int err;
+
+	if(pipe(pipe_wake))
+		c_die("Couldn't make a pipe: %s\n", strerror(errno));
+	fcntl(pipe_wake[1], F_SETFL, O_NONBLOCK);
+	err = pthread_create(&pipe_thread, NULL, pipe_render, NULL);
+	if(err)
+		c_die("Couldn't start thread: %s\n", strerror(err));
+	out = &pipe_backend;
+}
+#endif
+
+/* === --record and --replay ===
+   a recording is what was on screen every frame, as a header then
+   frames, and an index of keyframes at the end:
+
+   header: "CMXR", version (1), 0, message length (2), glyph flags (4),
+           then the -M messages, if any, with a form feed between.
+   frame:  'K' or 'D', microseconds since the last frame, length of
+           the rest, then for 'K' the number of cols and lines and every
+           cell, or for 'D' each changed cell as how far on it is from
+           the last one, and its new value.
+   index:  'I', then the time and file offset of every keyframe,
+           then the index's offset (8), keyframes (4), and "CMXI".
+
+   cells are laid out like matrix, and use the MTX_CELL_* layout. numbers
+   are little endian, and the variable length ones are LEB128. */
+
+#define REC_VERSION 1
+#define REC_KEY_US 1000000 /* a keyframe at least this often. */
+#define REC_GLYPH_FLAGS (MTX_FLAG_UNICODE | MTX_FLAG_LINUX | MTX_FLAG_XWINDOW)
+
+typedef struct
+{
+	uint64_t us;  /* since the start. */
+	uint64_t off; /* where it is in the file. */
+} mtx_key;
+
+FILE *rec_file = NULL;
+uint8_t *rec_buf = NULL; /* the frame being put together. */
+size_t rec_len = 0, rec_cap = 0;
+uint16_t *rec_prev = NULL; /* what the last frame left on screen. */
+int rec_ncols = 0, rec_lines = 0;
+uint64_t rec_start = 0, rec_last = 0, rec_key = 0; /* ns. */
+uint64_t rec_off = 0; /* bytes written so far. */
+mtx_key *rec_keys = NULL;
+uint32_t rec_nkeys = 0, rec_keys_cap = 0;
+
+/* LEB128 v into p, which needs room for 10 bytes. */
+int varint(uint8_t *p, uint64_t v)
+{
+	int n = 0;
+
+	while(v >= 0x80)
+	{
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+void rec_reserve(size_t n)
+{
+	if(rec_len + n <= rec_cap)
+		return;
+	while(rec_len + n > rec_cap)
+		rec_cap = rec_cap ? rec_cap * 2 : 4096;
+	rec_buf = nrealloc(rec_buf, rec_cap);
+}
+
+void rec_put_le(uint64_t v, int bytes)
+{
+	rec_reserve(bytes);
+	while(bytes--)
+	{
+		rec_buf[rec_len++] = v & 0xff;
+		v >>= 8;
+	}
+}
+
+void rec_put_varint(uint64_t v)
+{
+	rec_reserve(10);
+	rec_len += varint(rec_buf + rec_len, v);
+}
+
+void rec_write(void *buf, size_t len)
+{
+	if(len && fwrite(buf, 1, len, rec_file) != len)
+		c_die("Couldn't write the recording: %s\n", strerror(errno));
+	rec_off += len;
+}
+
+/* Finish the recording off with its index, on the way out. */
+void rec_close(void)
+{
+	uint32_t i;
+	uint64_t off = rec_off;
+
+	if(!rec_file)
+		return;
+	rec_len = 0;
+	rec_put_le('I', 1);
+	for(i=0; i<rec_nkeys; i++)
+	{
+		rec_put_le(rec_keys[i].us, 8);
+		rec_put_le(rec_keys[i].off, 8);
+	}
+	rec_put_le(off, 8);
+	rec_put_le(rec_nkeys, 4);
+	rec_put_le('C' | 'M' << 8 | 'X' << 16 | (uint32_t) 'I' << 24, 4);
+	rec_write(rec_buf, rec_len);
+	fclose(rec_file);
+	rec_file = NULL;
+}
+
+void rec_open(char *path, char *msg)
+{
+	size_t len = msg ? strlen(msg) : 0;
+
+	/* the header only has 2 bytes for how long it is. */
+	if(len > 0xffff)
+		c_die("The messages are too long to record, the most is 65535 bytes.\n");
+	if(!(rec_file = fopen(path, "wb")))
+		c_die("'%s' couldn't be opened: %s\n", path, strerror(errno));
+	rec_len = 0;
+	rec_put_le('C' | 'M' << 8 | 'X' << 16 | (uint32_t) 'R' << 24, 4);
+	rec_put_le(REC_VERSION, 1);
+	rec_put_le(0, 1);
+	rec_put_le(len, 2);
+	rec_put_le(flags & REC_GLYPH_FLAGS, 4);
+	rec_write(rec_buf, rec_len);
+	rec_write(msg, len);
+	atexit(rec_close);
+}
+
+/* What cell looks like in a recording. shadow can have cells under
+   a -M box, or ones the stats left to be drawn again, and those are
+   blanks as far as what's on screen goes. */
+static inline uint16_t rec_cell(uint16_t cell)
+{
+	return cell == MTX_CELL_COVERED || cell == MTX_CELL_INVALID ? MTX_BLANK : cell;
+}
+
+/* Add a frame that started at now, and left cells on screen. */
+void rec_frame(uint64_t now, uint16_t *cells)
+{
+	size_t n = (size_t) ncols * LINES, i, last = 0;
+	uint8_t head[21];
+	int key, len = 0;
+
+	if(!rec_start)
+		rec_start = rec_last = now;
+
+	/* a new size always needs a keyframe. */
+	key = ncols != rec_ncols || LINES != rec_lines || now - rec_key >= REC_KEY_US * 1000ULL;
+	if(ncols != rec_ncols || LINES != rec_lines)
+	{
+		free(rec_prev);
+		rec_prev = nmalloc(n * sizeof(uint16_t));
+		rec_ncols = ncols;
+		rec_lines = LINES;
+	}
+
+	rec_len = 0;
+	if(key)
+	{
+		rec_put_varint(ncols);
+		rec_put_varint(LINES);
+		for(i=0; i<n; i++)
+			rec_put_le(rec_cell(cells[i]), 2);
+
+		if(rec_nkeys == rec_keys_cap)
+		{
+			rec_keys_cap = rec_keys_cap ? rec_keys_cap * 2 : 64;
+			rec_keys = nrealloc(rec_keys, rec_keys_cap * sizeof(mtx_key));
+		}
+		rec_keys[rec_nkeys].us = (now - rec_start) / 1000;
+		rec_keys[rec_nkeys++].off = rec_off;
+		rec_key = now;
+	}
+	else
+	{
+		for(i=0; i<n; i++)
+		{
+			if(cells[i] == rec_prev[i])
+				continue;
+			rec_put_varint(i + 1 - last);
+			rec_put_le(rec_cell(cells[i]), 2);
+			last = i + 1;
+		}
+	}
+	memcpy(rec_prev, cells, n * sizeof(uint16_t));
+
+	head[len++] = key ? 'K' : 'D';
+	len += varint(head + len, (now - rec_last) / 1000);
+	len += varint(head + len, rec_len);
+	rec_write(head, len);
+	rec_write(rec_buf, rec_len);
+	/* whole microseconds only, so the rounding doesn't add up. */
+	rec_last += (now - rec_last) / 1000 * 1000;
+}
+
+uint8_t *rp_data = NULL; /* the whole recording. */
+size_t rp_size = 0, rp_end = 0; /* where the frames end. */
+size_t rp_pos = 0; /* the next frame. */
+uint64_t rp_us = 0; /* when the last frame played was. */
+uint16_t *rp_cells = NULL; /* what it left on screen, like rec_prev. */
+uint64_t rp_ncols = 0, rp_lines = 0;
+mtx_key *rp_keys = NULL;
+uint32_t rp_nkeys = 0;
+double rp_speed = 1; /* --speed, 0 is as fast as possible. */
+int rp_seeked = 0; /* rp_seek() has put a frame up that's not been shown. */
+uint64_t rp_start = 0; /* when, in ns, time 0 would have been played. */
+uint64_t rp_paused = 0; /* when 'p' was pressed, if it's paused. */
+char *rp_msg = NULL;
+
+uint64_t rd_le(const uint8_t *p, int bytes)
+{
+	uint64_t v = 0;
+
+	while(bytes--)
+		v = v << 8 | p[bytes];
+	return v;
+}
+
+/* Read a LEB128 number at *pos, if it's all before end. */
+int rd_varint(size_t *pos, size_t end, uint64_t *v)
+{
+	int shift = 0;
+
+	*v = 0;
+	while(*pos < end && shift < 64)
+	{
+		uint8_t b = rp_data[(*pos)++];
+		*v |= (uint64_t) (b & 0x7f) << shift;
+		if(!(b & 0x80))
+			return 1;
+		shift += 7;
+	}
+	return 0;
+}
+
+/* Read the header of the frame at *pos, leaving *pos at its body.
+   Returns its type, or 0 if there aren't any more. */
+int rp_head(size_t *pos, uint64_t *dt, uint64_t *len)
+{
+	int type;
+
+	if(*pos >= rp_end)
+		return 0;
+	type = rp_data[(*pos)++];
+	if((type != 'K' && type != 'D') || !rd_varint(pos, rp_end, dt) ||
+	   !rd_varint(pos, rp_end, len) || *len > rp_end - *pos)
+		return 0;
+	return type;
+}
+
+void rp_open(char *path)
+{
+	struct stat st;
+	size_t pos, msg_len;
+	int fd = open(path, O_RDONLY);
+
+	if(fd == -1 || fstat(fd, &st))
+		c_die("'%s' couldn't be opened: %s\n", path, strerror(errno));
+	rp_size = st.st_size;
+	if(rp_size < 12)
+		c_die("'%s' isn't a cmatrix recording.\n", path);
+#ifdef HAVE_SYS_MMAN_H
+	rp_data = mmap(NULL, rp_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if(rp_data == MAP_FAILED)
+		c_die("Couldn't map '%s': %s\n", path, strerror(errno));
+#else
+	rp_data = nmalloc(rp_size);
+	if(read(fd, rp_data, rp_size) != (ssize_t) rp_size)
+		c_die("Couldn't read '%s': %s\n", path, strerror(errno));
+#endif
+	close(fd);
+
+	if(memcmp(rp_data, "CMXR", 4) || rp_data[4] != REC_VERSION)
+		c_die("'%s' isn't a cmatrix recording.\n", path);
+	msg_len = rd_le(rp_data + 6, 2);
+	if(12 + msg_len > rp_size)
+		c_die("'%s' is cut short.\n", path);
+	flags = (flags & ~REC_GLYPH_FLAGS) | (rd_le(rp_data + 8, 4) & REC_GLYPH_FLAGS);
+	if(msg_len)
+	{
+		rp_msg = nmalloc(msg_len + 1);
+		memcpy(rp_msg, rp_data + 12, msg_len);
+		rp_msg[msg_len] = 0;
+	}
+	rp_pos = 12 + msg_len;
+	rp_end = rp_size;
+
+	/* use the index at the end if it's there. */
+	if(rp_size >= rp_pos + 17 && !memcmp(rp_data + rp_size - 4, "CMXI", 4))
+	{
+		uint64_t off = rd_le(rp_data + rp_size - 16, 8);
+		uint64_t n = rd_le(rp_data + rp_size - 8, 4);
+		uint32_t i;
+
+		if(off >= rp_pos && off + 1 + n * 16 + 16 == rp_size && rp_data[off] == 'I')
+		{
+			rp_keys = nmalloc(n * sizeof(mtx_key) + 1);
+			for(i=0; i<n; i++)
+			{
+				rp_keys[i].us = rd_le(rp_data + off + 1 + i * 16, 8);
+				rp_keys[i].off = rd_le(rp_data + off + 9 + i * 16, 8);
+			}
+			rp_nkeys = n;
+			rp_end = off;
+		}
+	}
+
+	/* without one, as when we got killed, go looking for the keyframes. */
+	if(!rp_keys)
+	{
+		uint64_t dt, len, us = 0;
+		uint32_t cap = 0;
+		size_t start;
+		int type;
+
+		for(pos = rp_pos; ; pos += len)
+		{
+			start = pos;
+			if(!(type = rp_head(&pos, &dt, &len)))
+				break;
+			us += dt;
+			if(type != 'K')
+				continue;
+			if(rp_nkeys == cap)
+			{
+				cap = cap ? cap * 2 : 64;
+				rp_keys = nrealloc(rp_keys, cap * sizeof(mtx_key));
+			}
+			rp_keys[rp_nkeys].us = us;
+			rp_keys[rp_nkeys++].off = start;
+		}
+		/* anything after a broken frame is no use. */
+		rp_end = start;
+	}
+	if(!rp_nkeys || rp_keys[0].off != rp_pos)
+		c_die("'%s' has no frames.\n", path);
+}
+
+/* Put a frame's body at pos into rp_cells. */
+void rp_apply(int type, size_t pos, size_t end)
+{
+	uint64_t cols, lines, gap, n = rp_ncols * rp_lines, last = 0, i;
+
+	if(type == 'K')
+	{
+		if(!rd_varint(&pos, end, &cols) || !rd_varint(&pos, end, &lines) ||
+		   !cols || !lines || cols > (end - pos) / 2 || lines > (end - pos) / 2 / cols)
+			return;
+		if(cols != rp_ncols || lines != rp_lines)
+		{
+			free(rp_cells);
+			rp_cells = nmalloc(cols * lines * sizeof(uint16_t));
+			rp_ncols = cols;
+			rp_lines = lines;
+		}
+		for(i=0; i<cols * lines; i++)
+			rp_cells[i] = rd_le(rp_data + pos + i * 2, 2);
+		return;
+	}
+
+	while(rd_varint(&pos, end, &gap) && pos + 2 <= end)
+	{
+		last += gap;
+		if(!gap || last > n)
+			return;
+		rp_cells[last - 1] = rd_le(rp_data + pos, 2);
+		pos += 2;
+	}
+}
+
+/* Stop the recording's clock, until the next rp_step() that isn't paused. */
+void rp_pause(uint64_t now)
+{
+	if(!rp_paused)
+		rp_paused = now;
+}
+
+/* Play whatever frames are due by now. Returns 0 after the last one. */
+int rp_step(uint64_t now)
+{
+	uint64_t dt, len;
+	size_t pos;
+	int type;
+
+	if(flags & MTX_FLAG_PAUSE)
+	{
+		rp_pause(now);
+		return 1;
+	}
+	if(rp_paused)
+	{
+		rp_start += now - rp_paused;
+		rp_paused = 0;
+	}
+	/* what rp_seek() landed on gets shown before anything after it. */
+	if(rp_seeked)
+	{
+		rp_seeked = 0;
+		return 1;
+	}
+
+	while(1)
+	{
+		pos = rp_pos;
+		if(!(type = rp_head(&pos, &dt, &len)))
+			return 0;
+		if(rp_speed > 0 && (rp_us + dt) * 1000 / rp_speed > now - rp_start)
+			return 1;
+		rp_apply(type, pos, pos + len);
+		rp_us += dt;
+		rp_pos = pos + len;
+		/* as fast as possible is a frame at a time. */
+		if(rp_speed <= 0)
+			return 1;
+	}
+}
+
+/* When the next frame should be played, in ns. */
+uint64_t rp_due(uint64_t now)
+{
+	uint64_t dt, len;
+	size_t pos = rp_pos;
+
+	if(rp_speed <= 0 || (flags & MTX_FLAG_PAUSE) || !rp_head(&pos, &dt, &len))
+		return now;
+	return rp_start + (uint64_t) ((rp_us + dt) * 1000 / rp_speed);
+}
 
-		/* And length of the stream */
-		length[i] = (int) rand_func() % (LINES/2) + 3;
+/* Jump to us into the recording, from the keyframe before it. */
+void rp_seek(int64_t us, uint64_t now)
+{
+	uint32_t k = 0, i;
+	uint64_t dt, len;
+	size_t pos;
+	int type;
+
+	if(us < 0)
+		us = 0;
+	for(i=0; i<rp_nkeys; i++)
+		if(rp_keys[i].us <= (uint64_t) us)
+			k = i;
 
-		/* And set updates[] array for update speed. */
-		updates[i] = (int) rand_func() % 3 + 1;
+	rp_pos = rp_keys[k].off;
+	rp_us = rp_keys[k].us;
+	for(i=0; ; i++)
+	{
+		pos = rp_pos;
+		if(!(type = rp_head(&pos, &dt, &len)))
+			break;
+		/* the keyframe's dt is already in its time. */
+		if(i && rp_us + dt > (uint64_t) us)
+			break;
+		if(i)
+			rp_us += dt;
+		rp_apply(type, pos, pos + len);
+		rp_pos = pos + len;
 	}
+	rp_start = now - (uint64_t) (rp_us * 1000 / (rp_speed > 0 ? rp_speed : 1));
+	if(rp_paused)
+		rp_paused = now;
+	rp_seeked = 1;
 }
 
-short rand_char()
+/* The played frame's cell at line i, col j, blank if it's off its edge. */
+uint16_t rp_cell(int i, int j)
 {
-	return (rand_func() % (randmax - randmin)) + randmin;
+	if((uint64_t) j >= rp_ncols || (uint64_t) i >= rp_lines)
+		return 0;
+	return rp_cells[j * rp_lines + i];
 }
 
-#ifndef _WIN32
-void sighandler(int s)
+void rp_draw(void)
 {
-	signal_status = s;
+	int i, j;
+
+	for(j=0; j<ncols; j++)
+	{
+		uint16_t *drawn = shadow + j * LINES;
+		for(i=0; i<LINES; i++)
+		{
+			uint16_t cell = cell_cover(rp_cell(i, j), cover[j * LINES + i]);
+			if(drawn[i] == cell)
+				continue;
+			drawn[i] = cell;
+			out->draw_cell(i, j*2, cell);
+			stats.cells++;
+		}
+	}
 }
-#endif
 
-void resize_screen(void)
+void rp_compose(uint16_t *dst)
 {
-#ifdef _WIN32
-	BOOL result;
-	HANDLE hStdHandle;
-	CONSOLE_SCREEN_BUFFER_INFO csbiInfo;
-
-	hStdHandle = GetStdHandle(STD_OUTPUT_HANDLE);
-	if(hStdHandle == INVALID_HANDLE_VALUE)
-		return;
+	int i, j;
 
-	result = GetConsoleScreenBufferInfo(hStdHandle, &csbiInfo);
-	if(!result)
-		return;
-	LINES = csbiInfo.dwSize.Y;
-	COLS = csbiInfo.dwSize.X;
-#else
-	char *tty;
-	int fd = 0;
-	int result = 0;
-	struct winsize win;
+	for(j=0; j<ncols; j++)
+		for(i=0; i<LINES; i++)
+			dst[j * LINES + i] = cell_cover(rp_cell(i, j), cover[j * LINES + i]);
+}
 
-	/* get size of tty. */
-	tty = ttyname(0);
-	if (!tty)
-		return;
-	fd = open(tty, O_RDWR);
-	if (fd == -1)
-		return;
-	result = ioctl(fd, TIOCGWINSZ, &win);
-	if (result == -1)
-		return;
+/* What --bench prints once it's done. */
+void bench_report(void)
+{
+	double secs = (stats.update_ns + stats.draw_ns + stats.flush_ns) / 1e9;
+	double frames = stats.frames;
 
-	COLS = win.ws_col;
-	LINES = win.ws_row;
+	printf("cmatrix: %llu frames of %dx%d in %.3f s, %.1f frames/sec\n",
+	       (unsigned long long) stats.frames, COLS, LINES, secs, secs > 0 ? frames / secs : 0);
+#ifndef _WIN32
+	printf(" output: %.1f bytes/frame\n", stats.bytes / frames);
 #endif
-
-	/* reset to minimums. */
-	if(LINES < 10)
-		LINES = 10;
-	if(COLS < 10)
-		COLS = 10;
-
-	/* resize to larger window if needed. */
-#ifdef HAVE_RESIZETERM
-	resizeterm(LINES, COLS);
-#ifdef HAVE_WRESIZE
-	if(wresize(stdscr, LINES, COLS) == ERR)
-		c_die("Cannot resize window!\n");
-#endif /* HAVE_WRESIZE */
-#endif /* HAVE_RESIZETERM */
-
-	/* realloc everything for new size. */
-	var_init();
-	/* Do these because width may have changed... */
-	clear();
-	refresh();
+	printf(" update: %.2f us/frame\n", stats.update_ns / frames / 1e3);
+	printf(" draw:   %.2f us/frame\n", stats.draw_ns / frames / 1e3);
+	printf(" flush:  %.2f us/frame\n", stats.flush_ns / frames / 1e3);
+#ifdef USE_PIPELINE
+	if(flags & MTX_FLAG_PIPELINE)
+		printf(" dropped: %llu frames\n", (unsigned long long) pipe_dropped);
+#endif
+	if(flags & MTX_FLAG_HISTOGRAM)
+	{
+		fflush(stdout);
+		hist_print();
+	}
+	exit(0);
 }
 
-/* essentially, with utf-8, you aren't
-   able to print 8-bit chars. you have
-   to print utf-8 strings. */
-/* this scheme also doesn't seem to work
-   in the linux console, but that's not
-   surprising, as utf-8 in general doesn't
-   seem to work there. it does work with
-   xterm, though. */
-#ifdef HAVE_NCURSESW_NCURSES_H
-void addch_utf8_altcharset(uint8_t c)
+/* The last of the frames without a terminal is done. */
+void headless_done(void)
 {
-	char str[3];
-	str[0] = 0xC0 | ((c & 0xC0) >> 6);
-	str[1] = 0x80 | (c & 0x3F);
-	str[2] = 0;
-	addstr(str);
-}
+#ifdef USE_PIPELINE
+	pipe_drain();
+	/* it's done, so its counts can be had straight from it. */
+	if(flags & MTX_FLAG_PIPELINE)
+		pipe_collect(&pipe_stats);
 #endif
+	if(flags & MTX_FLAG_BENCH)
+		bench_report();
+	finish();
+}
 
 int main(int argc, char *argv[])
 {
-	int i, j, y, z, keypress;
+	int i, keypress;
+	uint64_t t0, t1, t2, t3, last_t0 = 0;
+	int behind = 0, skips = 0, due = 1, stopped = 0, was_stopped = 0, typed = 0;
+	mtx_band *slow = bands;
+	int input_fd = STDIN_FILENO; /* where keys come from. */
 
-	char *color_names[NUM_COLORS] = {"green",     "red",     "blue",     "yellow",     "cyan",     "magenta",     "white"};
-	int color_vals[NUM_COLORS]    = {COLOR_GREEN, COLOR_RED, COLOR_BLUE, COLOR_YELLOW, COLOR_CYAN, COLOR_MAGENTA, COLOR_WHITE};
 	int mcolor = COLOR_GREEN;
-	char *msg = NULL, *tty = NULL;
-	int count = 0;
+	char *tty = NULL;
+	char *record = NULL, *replay = NULL, *export = NULL;
+#ifdef HAVE_SYS_UN_H
+	char *control = NULL;
+#endif
+	double seek = 0;
+	int more = 1; /* frames left to --replay. */
 	int update = 4;
-	int msg_x=0, msg_y=0, msg_len=0; /* bluh, it 'might be used uninitialized,' bluh! */
 
-	srand((unsigned) time(NULL));
+#ifdef _WIN32
+	seed = (uint64_t) time(NULL);
+#else
+	/* lots of instances tend to get started at once. */
+	seed = (uint64_t) time(NULL) ^ ((uint64_t) getpid() << 32);
+#endif
 
 	/* get arguments. */
 	while(1)
 	{
-		int optchr = getopt(argc, argv, "aAbBcfhklLnrosmpxVM:u:C:t:P:");
+		int optchr = getopt_long(argc, argv, "aAbBcfhklLnrosmpxVM:u:C:t:P:", long_options, NULL);
 		if(optchr == -1)
 			break;
 		if(optopt)
@@ -526,15 +3983,10 @@ int main(int argc, char *argv[])
 			case 'o': flags |= MTX_FLAG_OLD; break;
 			case 'L':
 				flags |= MTX_FLAG_LOCK;
-				/* if -M was used earlier, don't override it. */
-				if(!(flags & MTX_FLAG_MSG))
-				{
-					msg = "Computer locked.";
-					flags |= MTX_FLAG_MSG;
-				}
 				break;
 			case 'M':
-				msg = optarg;
+				/* each one gets its own box. */
+				overlay_add(optarg);
 				flags |= MTX_FLAG_MSG;
 				break;
 			case 'P':
@@ -548,13 +4000,127 @@ int main(int argc, char *argv[])
 			case 'V': printf("%s", version); exit(0);
 			case 'r': flags |= MTX_FLAG_RAINBOW; break;
 			case 'k': flags |= MTX_FLAG_CHANGES; break;
+#ifdef _WIN32
 			case 't': tty = optarg; break;
+#else
+			case 't':
+				if(nttys == MAX_TTYS)
+					c_die("Too many ttys, %d at most.\n", MAX_TTYS);
+				ttys[nttys++].name = optarg;
+				break;
+#endif
+			case OPT_ANSI: flags |= MTX_FLAG_ANSI; break;
+			case OPT_FADE: flags |= MTX_FLAG_FADE | MTX_FLAG_ANSI; break;
+			case OPT_SEED:
+				{
+					char *end;
+					errno = 0;
+					seed = strtoull(optarg, &end, 0);
+					if(errno || end == optarg || *end)
+						c_die("Invalid seed.\n");
+				}
+				break;
+			case OPT_HISTOGRAM: flags |= MTX_FLAG_HISTOGRAM; break;
+			case OPT_FRAMESKIP: flags |= MTX_FLAG_FRAMESKIP; break;
+			case OPT_BENCH: case OPT_FRAMES:
+				{
+					char *end;
+					errno = 0;
+					bench_frames = strtoull(optarg, &end, 10);
+					if(errno || end == optarg || *end || !bench_frames)
+						c_die("Invalid number of frames.\n");
+					if(optchr == OPT_BENCH)
+						flags |= MTX_FLAG_BENCH;
+				}
+				break;
+#ifndef _WIN32
+			case OPT_CAST: case OPT_TTYREC:
+				export = optarg;
+				export_format = optchr == OPT_CAST ? EXPORT_CAST : EXPORT_TTYREC;
+				break;
+#endif
+			case OPT_SIZE:
+				if(sscanf(optarg, "%dx%d", &bench_cols, &bench_lines) != 2 || bench_cols < 10 || bench_lines < 10)
+					c_die("Invalid size, it should be like 300x100, and at least 10x10.\n");
+				break;
+#ifdef HAVE_PTHREAD_H
+			case OPT_THREADS:
+				nthreads = atoi(optarg);
+				if(nthreads < 1 || nthreads > MAX_THREADS)
+					c_die("Invalid number of threads, it should be 1 - %d.\n", MAX_THREADS);
+				break;
+#endif
+#ifdef USE_PIPELINE
+			case OPT_PIPELINE: flags |= MTX_FLAG_PIPELINE | MTX_FLAG_ANSI; break;
+#endif
+#ifdef HAVE_SYS_MMAN_H
+			case OPT_MLOCK: flags |= MTX_FLAG_MLOCK; break;
+#endif
+#ifdef HAVE_SYS_UN_H
+			case OPT_CONTROL: control = optarg; break;
+#endif
+			case OPT_RECORD: record = optarg; break;
+			case OPT_REPLAY: replay = optarg; break;
+			case OPT_SPEED:
+				rp_speed = atof(optarg);
+				if(rp_speed < 0)
+					c_die("Invalid speed.\n");
+				break;
+			case OPT_SEEK: seek = atof(optarg); break;
 		}
 	}
 
 	if(optind!=argc)
 		c_die("Unrecognized additonal arguments.\n");
 
+#ifndef _WIN32
+	/* one -t is just where to draw, more all get the same frames,
+	   which curses can't do. */
+	if(nttys == 1)
+		tty = ttys[--nttys].name;
+	else if(nttys)
+		flags |= MTX_FLAG_ANSI;
+#endif
+
+	/* --frames is how long a clip is, and there's nothing else to
+	   run that many frames of with nothing to show for it. */
+	if(bench_frames && !export && !(flags & MTX_FLAG_BENCH))
+		c_die("--frames needs --cast or --ttyrec.\n");
+	/* a clip is 10 seconds unless it's told otherwise. */
+	if(export && !bench_frames)
+		bench_frames = 250;
+
+	/* -L has a message of its own, unless there's a -M. */
+	if((flags & MTX_FLAG_LOCK) && !(flags & MTX_FLAG_MSG))
+	{
+		overlay_add("Computer locked.");
+		flags |= MTX_FLAG_MSG;
+	}
+
+	/* a recording brings its own chars and messages. */
+	if(replay)
+	{
+		rp_open(replay);
+		if(rp_msg && !(flags & MTX_FLAG_MSG))
+		{
+			char *text, *next;
+
+			for(text = rp_msg; text; text = next)
+			{
+				if((next = strchr(text, '\f')))
+					*next++ = 0;
+				overlay_add(text);
+			}
+			flags |= MTX_FLAG_MSG;
+		}
+		/* nothing to move along. */
+		nthreads = 1;
+		if(bench_frames)
+			rp_speed = 0;
+	}
+	if(record)
+		rec_open(record, overlay_text());
+
 	/* if bold is none, set to 0. */
 	/* 3 was a temp value to prevent overwriting. */
 	if((flags & MTX_FLAG_BOLD) == MTX_FLAG_BOLD_NONE)
@@ -574,6 +4140,11 @@ int main(int argc, char *argv[])
 		randmin = 166;
 		randmax = 217;
 	}
+	glyphs_init();
+#ifndef _WIN32
+	ansi_colors_init();
+#endif
+	kernels_select();
 
 	/* Clear TERM variable on Windows */
 #ifdef _WIN32
@@ -599,106 +4170,186 @@ int main(int argc, char *argv[])
 	}
 #endif
 
-	/* set tty if -t is set. */
-	if(tty)
+#ifndef _WIN32
+	if(bench_frames)
 	{
-		FILE *ftty = fopen(tty, "r+");
-		SCREEN *ttyscr;
-		if(!ftty)
+		/* frames only get encoded and counted, never written. */
+		LINES = bench_lines;
+		COLS = bench_cols;
+		flags |= MTX_FLAG_ANSI;
+		ansi_out = -1;
+		nttys = 0;
+		out = &ansi_backend;
+		if(export)
 		{
-			fprintf(stderr, "cmatrix: '%s' couldn't be opened: %s\n", tty, strerror(errno));
-			exit(EXIT_FAILURE);
+			export_open(export, export_format);
+			/* one frame per -u, even if it's 0. */
+			export_period = (update ? update : 1) * 10000;
+			ansi_puts(&ansi_main, "\033[?25l\033[0m\033[2J");
 		}
-		ttyscr = newterm(NULL, ftty, ftty);
-		if(ttyscr == NULL)
-			exit(EXIT_FAILURE);
-		set_term(ttyscr);
+	}
+	else if(flags & MTX_FLAG_ANSI)
+	{
+		int k;
+
+		/* -t is both where we draw and where keys come from. */
+		for(k=0; k<nttys; k++)
+			tty_open(&ttys[k]);
+		if(nttys)
+			ansi_in = ansi_out = ttys[0].fd;
+		else if(tty)
+		{
+			ansi_in = ansi_out = open(tty, O_RDWR | O_NOCTTY);
+			if(ansi_out == -1)
+			{
+				fprintf(stderr, "cmatrix: '%s' couldn't be opened: %s\n", tty, strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		if(!ansi_size())
+		{
+			LINES = 24;
+			COLS = 80;
+		}
+		ansi_start();
+		out = &ansi_backend;
+		input_fd = ansi_in;
 	}
 	else
-		initscr();
-	savetty();
+#endif
+	{
+		/* set tty if -t is set. */
+		if(tty)
+		{
+			FILE *ftty = fopen(tty, "r+");
+			SCREEN *ttyscr;
+			if(!ftty)
+			{
+				fprintf(stderr, "cmatrix: '%s' couldn't be opened: %s\n", tty, strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			ttyscr = newterm(NULL, ftty, ftty);
+			if(ttyscr == NULL)
+				exit(EXIT_FAILURE);
+			set_term(ttyscr);
+			input_fd = fileno(ftty);
+#ifndef _WIN32
+			size_fd = input_fd;
+#endif
+		}
+		else
+			initscr();
+		savetty();
+#ifndef _WIN32
+		focus_fd = tty ? input_fd : STDOUT_FILENO;
+		if(!isatty(focus_fd))
+			focus_fd = -1;
+		focus_report(1);
+#endif
+
+		/* set up curses. */
+		nonl();
+#ifdef _WIN32
+		raw();
+#else
+		cbreak();
+#endif
+		noecho();
+		timeout(0);
+		leaveok(stdscr, TRUE);
+		curs_set(0);
+
+		if(has_colors())
+		{
+			start_color();
+			/* Add in colors, if available */
+#ifdef HAVE_USE_DEFAULT_COLORS
+			if(use_default_colors() != ERR)
+			{
+				init_pair(COLOR_BLACK, -1, -1);
+				init_pair(COLOR_GREEN, COLOR_GREEN, -1);
+				init_pair(COLOR_WHITE, COLOR_WHITE, -1);
+				init_pair(COLOR_RED, COLOR_RED, -1);
+				init_pair(COLOR_CYAN, COLOR_CYAN, -1);
+				init_pair(COLOR_MAGENTA, COLOR_MAGENTA, -1);
+				init_pair(COLOR_BLUE, COLOR_BLUE, -1);
+				init_pair(COLOR_YELLOW, COLOR_YELLOW, -1);
+			}
+			else
+#endif
+			{
+				init_pair(COLOR_BLACK, COLOR_BLACK, COLOR_BLACK);
+				init_pair(COLOR_GREEN, COLOR_GREEN, COLOR_BLACK);
+				init_pair(COLOR_WHITE, COLOR_WHITE, COLOR_BLACK);
+				init_pair(COLOR_RED, COLOR_RED, COLOR_BLACK);
+				init_pair(COLOR_CYAN, COLOR_CYAN, COLOR_BLACK);
+				init_pair(COLOR_MAGENTA, COLOR_MAGENTA, COLOR_BLACK);
+				init_pair(COLOR_BLUE, COLOR_BLUE, COLOR_BLACK);
+				init_pair(COLOR_YELLOW, COLOR_YELLOW, COLOR_BLACK);
+			}
+		}
+		out = &curses_backend;
+	}
 
-	/* change the font to matrix.psf if -l is set. */
+	/* change the font to matrix.psf if -l is set, and there's a screen. */
 #ifdef HAVE_CONSOLECHARS
-	if(flags & MTX_FLAG_LINUX)
+	if((flags & MTX_FLAG_LINUX) && !bench_frames)
 	{
 		if(va_system("consolechars -f matrix"))
 			c_die("There was an error running consolechars.\nPlease make sure the consolechars program is in your $PATH. Try running \"setfont matrix\" by hand.\n");
 	}
 #elif defined(HAVE_SETFONT)
-	if(flags & MTX_FLAG_LINUX)
+	if((flags & MTX_FLAG_LINUX) && !bench_frames)
 	{
 		if(va_system("setfont matrix.psf"))
 			c_die("There was an error running setfont.\nPlease make sure the setfont program is in your $PATH. Try running \"setfont matrix\" by hand.\n");
 	}
 #endif
 
-	/* set up curses. */
-	nonl();
-#ifdef _WIN32
-	raw();
-#else
-	cbreak();
-#endif
-	noecho();
-	timeout(0);
-	leaveok(stdscr, TRUE);
-	curs_set(0);
-#ifndef _WIN32
-	/* these don't work properly under ansi, in my testing. */
+#ifdef HAVE_POLL_H
+	if(!bench_frames)
+		events_init(input_fd);
+#elif !defined(_WIN32)
 	signal(SIGINT, sighandler);
 	signal(SIGQUIT, sighandler);
 	signal(SIGWINCH, sighandler);
 	signal(SIGTSTP, sighandler);
 #endif
-
-	if(has_colors())
-	{
-		start_color();
-		/* Add in colors, if available */
-#ifdef HAVE_USE_DEFAULT_COLORS
-		if(use_default_colors() != ERR)
-		{
-			init_pair(COLOR_BLACK, -1, -1);
-			init_pair(COLOR_GREEN, COLOR_GREEN, -1);
-			init_pair(COLOR_WHITE, COLOR_WHITE, -1);
-			init_pair(COLOR_RED, COLOR_RED, -1);
-			init_pair(COLOR_CYAN, COLOR_CYAN, -1);
-			init_pair(COLOR_MAGENTA, COLOR_MAGENTA, -1);
-			init_pair(COLOR_BLUE, COLOR_BLUE, -1);
-			init_pair(COLOR_YELLOW, COLOR_YELLOW, -1);
-		}
-		else
+#ifdef HAVE_SYS_UN_H
+	if(control)
+		control_open(control);
 #endif
-		{
-			init_pair(COLOR_BLACK, COLOR_BLACK, COLOR_BLACK);
-			init_pair(COLOR_GREEN, COLOR_GREEN, COLOR_BLACK);
-			init_pair(COLOR_WHITE, COLOR_WHITE, COLOR_BLACK);
-			init_pair(COLOR_RED, COLOR_RED, COLOR_BLACK);
-			init_pair(COLOR_CYAN, COLOR_CYAN, COLOR_BLACK);
-			init_pair(COLOR_MAGENTA, COLOR_MAGENTA, COLOR_BLACK);
-			init_pair(COLOR_BLUE, COLOR_BLUE, COLOR_BLACK);
-			init_pair(COLOR_YELLOW, COLOR_YELLOW, COLOR_BLACK);
-		}
-	}
+
 
 	/* malloc. */
 	var_init();
 	if(flags & MTX_FLAG_PREALLOC)
 		rand_pre_init();
 
-	/* message box location. */
-	if(flags & MTX_FLAG_MSG)
-	{
-		msg_y = LINES/2 - 1;
-		msg_x = (COLS - strlen(msg))/2 - 2;
-		msg_len = strlen(msg)+4;
-	}
+	/* curses can only be used from one thread, so there the
+	   bands only move the matrix along, and get drawn here. */
+#ifndef _WIN32
+	band_frags = nthreads > 1 && (flags & MTX_FLAG_ANSI) && !(flags & MTX_FLAG_PIPELINE);
+#endif
+#ifdef HAVE_PTHREAD_H
+	bands_start();
+#endif
+#ifdef USE_PIPELINE
+	if(flags & MTX_FLAG_PIPELINE)
+		pipe_start();
+#endif
 
 	/* === main loop === */
+	frame_deadline = now_ns();
+	if(replay)
+		rp_seek(seek * 1e6, frame_deadline);
 	while(1)
 	{
 #ifndef _WIN32
+		/* the -t ttys can't tell us when they're resized. */
+		if(nttys && !signal_status && ttys_resized(now_ns()))
+			signal_status = SIGWINCH;
 		/* Check for signals */
 		switch(signal_status)
 		{
@@ -709,241 +4360,187 @@ int main(int argc, char *argv[])
 				break;
 
 			case SIGWINCH:
+#ifdef USE_PIPELINE
+				/* the render thread is using the screen state. */
+				pipe_drain();
+#endif
 				resize_screen();
-				/* update with new COLS or LINES. */
-				if(flags & MTX_FLAG_MSG)
-				{
-					msg_y = LINES/2;
-					msg_x = (COLS - strlen(msg))/2;
-				}
+				/* it's blank now, even if nothing's moving. the
+				   boxes were put in place again along with it. */
+				due = 1;
 				signal_status = 0;
 				break;
 		}
 #endif
 
-		/* update and draw matrix. */
-		for(j=0; j<COLS; j+=2)
+		if(due)
 		{
-			/* update column (if turn and not paused). */
-			if((count > updates[j] || !(flags & MTX_FLAG_ASYNC)) && !(flags & MTX_FLAG_PAUSE))
+			/* update and draw matrix. */
+			t0 = now_ns();
+			if(last_t0)
+				hist_add((t0 - last_t0) / 1000);
+			last_t0 = t0;
+
+			/* with --frameskip, a late frame only gets simulated, so
+			   we catch up. the next one drawn shows what was missed. */
+			if(behind && (flags & MTX_FLAG_FRAMESKIP) && skips < 8)
+			{
+				skips++;
+				stats.skipped++;
+			}
+			else
+				skips = 0;
+
+#ifdef USE_PIPELINE
+			/* drawing is the render thread's job, we just say what. */
+			if(flags & MTX_FLAG_PIPELINE)
 			{
-				/* old-style (real) scrolling. */
-				if(flags & MTX_FLAG_OLD)
+				mtx_frame *f = skips ? NULL : pipe_next();
+
+				if(replay)
 				{
-					y=0;
-					flags |= MTX_FLAG_CONCURCOL;
-					/* scroll the whole column down. */
-					for(i=LINES-1; i>=1; i--)
-					{
-						matrix[i][j] = matrix[i - 1][j];
-						/* get length of column, resetting when reaching the next. */
-						if(flags & MTX_FLAG_CONCURCOL)
-						{
-							if(matrix[i][j]==MTX_BLANK)
-								flags &= ~MTX_FLAG_CONCURCOL;
-							else
-								y++;
-						}
-						else
-						{
-							if(matrix[i][j]!=MTX_BLANK)
-							{
-								y=0;
-								flags |= MTX_FLAG_CONCURCOL;
-							}
-						}
-					}
-					/* create new column. */
-					if(matrix[1][j] == MTX_BLANK)
-					{
-						/* fill gap with blanks. */
-						if(spaces[j]>0)
-						{
-							matrix[0][j] = MTX_BLANK;
-							spaces[j]--;
-						}
-						else
-						{
-							/* Random number to determine whether head of next collumn
-							   of chars has a white 'head' on it. */
-							if((rand_func() % 3) == 1)
-								matrix[0][j] = MTX_HEAD;
-							else
-								matrix[0][j] = rand_char();
-							length[j] = (rand_func() % (LINES/2)) + 3;
-							spaces[j] = (rand_func() % LINES) + 1;
-						}
-					}
-					/* fill in column. */
-					else if(y<length[j])
-						matrix[0][j] = rand_char();
-					/* create gap. */
-					else
-						matrix[0][j] = MTX_BLANK;
+					more = rp_step(t0);
+					if(f)
+						rp_compose(f->cells);
 				}
-				/* new-style (fake) scrolling. */
 				else
 				{
-					/* last column is done growing. */
-					if(matrix[0][j] == MTX_BLANK)
-					{
-						if(spaces[j] > 0)
-							spaces[j]--;
-						/* create new column. */
-						else
-						{
-							length[j] = (rand_func() % (LINES/2)) + 3;
-							matrix[0][j] = MTX_HEAD;
-							spaces[j] = (rand_func() % LINES) + 1;
-						}
-					}
-					i = 0;
-					y = 0;
-					flags &= ~MTX_FLAG_FIRSTCOL;
-					while(i < LINES)
+					band_dst = f ? f->cells : NULL;
+					bands_run(f ? mcolor : -1);
+				}
+				if(f)
+				{
+					if(record)
+						rec_frame(t0, f->cells);
+					f->hud = (flags & MTX_FLAG_HUD) != 0;
+					if(f->hud)
 					{
-						/* Skip over spaces */
-						while (i < LINES && matrix[i][j] == MTX_BLANK)
-							i++;
-						if(i >= LINES)
-							break;
-
-						/* Go to the end of this column */
-						z = i;
-						y = 0;
-						while(i < LINES && matrix[i][j] != MTX_BLANK)
-						{
-							if(flags & MTX_FLAG_CHANGES)
-							{
-								if(!(rand_func() & 7))
-									matrix[i][j] = rand_char();
-							}
-							i++;
-							y++;
-						}
-
-						/* replace old head with normal char. */
-						if(i && matrix[i-1][j] == MTX_HEAD)
-							matrix[i-1][j] = rand_char();
-
-						/* create new head. */
-						if(i < LINES)
-							matrix[i][j] = MTX_HEAD;
-
-						/* If we're at the top of the column and it's reached its
-						   full length (about to start moving down), we do this
-						   to get it moving.  This is also how we keep segment_sizes not
-						   already growing from growing accidentally => */
-						if(y > length[j] || (flags & MTX_FLAG_FIRSTCOL))
-							matrix[z][j] = MTX_BLANK;
-						flags |= MTX_FLAG_FIRSTCOL;
-						i++;
+						hud_update(t0);
+						memcpy(f->hud_text, hud_text, sizeof(hud_text));
 					}
+					pipe_publish();
 				}
+				t1 = t2 = now_ns();
 			}
-
-			/* draw each line. */
-			for(i = 0; i < LINES; i++)
+			else
+#endif
 			{
-				move(i, j);
-
-#ifndef HAVE_NCURSESW_NCURSES_H
-				if(flags & (MTX_FLAG_LINUX | MTX_FLAG_XWINDOW))
-					attron(A_ALTCHARSET);
+#ifndef _WIN32
+				/* whatever's waiting goes out before the bands' frags. */
+				if(band_frags && !skips)
+				{
+					ansi_emit(&ansi_main);
+					ansi_mark = ansi_main.len;
+				}
 #endif
+				if(replay)
+					more = rp_step(t0);
+				else
+					bands_run(band_frags && !skips ? mcolor : -1);
+				t1 = now_ns();
 
-				/* draw head. */
-				if(matrix[i][j] == MTX_HEAD)
+				if(!skips)
 				{
-					short c;
-					/* attrs. */
-					attron(COLOR_PAIR(COLOR_WHITE));
-					if(flags & MTX_FLAG_BOLD)
-						attron(A_BOLD);
-
-					/* get character. */
-					if(matrix[i][j] & MTX_FLAG_PAUSE)
+					/* the slowest band is what the frame waited for. */
+					slow = &bands[0];
+					if(replay)
+						rp_draw();
+					else for(i=0; i<nthreads; i++)
 					{
-						/* kind of a hack, but needed to reduce load. */
-						c = ((i+j) % (randmax - randmin)) + randmin;
+						if(!band_frags)
+							matrix_draw(mcolor, &bands[i]);
+						else if(bands[i].update_ns + bands[i].draw_ns > slow->update_ns + slow->draw_ns)
+							slow = &bands[i];
+						stats.cells += bands[i].cells;
+					}
+#ifndef _WIN32
+					if(band_frags)
+					{
+						ansi_nfrags = nthreads;
+						ansi_forget(&ansi_main);
 					}
-					else
-						c = rand_char();
-
-#ifdef HAVE_NCURSESW_NCURSES_H
-					if(flags & MTX_FLAG_UNICODE)
-						addstr(chars_array[c]);
-					else if(flags & (MTX_FLAG_LINUX | MTX_FLAG_XWINDOW))
-						addch_utf8_altcharset(c);
-					else
 #endif
-						addch(c);
-
+					if(record)
+						rec_frame(t0, shadow);
 
-					attroff(COLOR_PAIR(COLOR_WHITE));
-					if(flags & MTX_FLAG_BOLD)
-						attroff(A_BOLD);
+					/* if -M or -L, and they're not up already. */
+					if(!overlay_shown)
+						overlay_draw();
 
-					if(flags & MTX_FLAG_RAINBOW)
-						mcolor = color_vals[(j>>1) % 6];
+					if(flags & MTX_FLAG_HUD)
+					{
+						hud_update(t0);
+						hud_draw(hud_text);
+					}
 				}
-				else if(matrix[i][j] > 0)
-				{
-					/* enable effects. */
-					attron(COLOR_PAIR(mcolor));
-					if(((flags & MTX_FLAG_BOLD) == MTX_FLAG_BOLD_ALL) || (((flags & MTX_FLAG_BOLD) == MTX_FLAG_BOLD_SOME) && (matrix[i][j] & 1)))
-						attron(A_BOLD);
 
-					/* draw char. */
-#ifdef HAVE_NCURSESW_NCURSES_H
-					if(flags & MTX_FLAG_LAMBDA)
-						addstr("λ");
-					else if(flags & MTX_FLAG_UNICODE)
-						addstr(chars_array[matrix[i][j]]);
-					else if(flags & (MTX_FLAG_LINUX | MTX_FLAG_XWINDOW))
-						addch_utf8_altcharset(matrix[i][j]);
-					else
-#endif
-						addch(matrix[i][j]);
-
-					/* disable effects. */
-					if(((flags & MTX_FLAG_BOLD) == MTX_FLAG_BOLD_ALL) || (((flags & MTX_FLAG_BOLD) == MTX_FLAG_BOLD_SOME) && (matrix[i][j] & 1)))
-						attroff(A_BOLD);
-					attroff(COLOR_PAIR(mcolor));
-				}
-				else
-					addch(' ');
+				/* get the frame onto the screen. with curses,
+				   getting input is what does that. */
+				t2 = now_ns();
+				if((flags & MTX_FLAG_ANSI) && !skips)
+					out->flush();
+			}
+		}
+		keypress = bench_frames ? ERR : get_key();
+		typed = keypress != ERR;
+#ifdef HAVE_SYS_UN_H
+		/* --control's commands come in as keys, but nobody typed them. */
+		if(!typed)
+			keypress = control_key();
+#endif
+		if(due)
+		{
+			t3 = now_ns();
 
-#ifndef HAVE_NCURSESW_NCURSES_H
-				if(flags & (MTX_FLAG_LINUX | MTX_FLAG_XWINDOW))
-					attroff(A_ALTCHARSET);
+			stats.frames++;
+#ifdef USE_PIPELINE
+			/* the render thread counts its own time. */
+			if(flags & MTX_FLAG_PIPELINE)
+				stats.update_ns += t1 - t0;
+			else
 #endif
+			if(band_frags && !skips)
+			{
+				stats.update_ns += t1 - t0 - slow->draw_ns;
+				stats.draw_ns += t2 - t1 + slow->draw_ns;
+			}
+			else
+			{
+				stats.update_ns += t1 - t0;
+				stats.draw_ns += t2 - t1;
+			}
+			if(!(flags & MTX_FLAG_PIPELINE))
+			{
+				stats.flush_ns += t3 - t2;
+#ifndef _WIN32
+				stats.bytes = ansi_bytes;
+#endif
+			}
+			if(stats.frames == bench_frames)
+				headless_done();
+			/* the end of a recording is the end of us. */
+			if(!more)
+			{
+				if(bench_frames)
+					headless_done();
+				finish();
 			}
-		}
 
-		/* if -M or -L. */
-		if(flags & MTX_FLAG_MSG)
-		{
-			move(msg_y, msg_x);
-			for(i=0; i<msg_len; i++)
-				addch(' ');
-
-			move(msg_y+1, msg_x);
-			addstr("  ");
-			addstr(msg);
-			addstr("  ");
-
-			move(msg_y+2, msg_x);
-			for(i=0; i<msg_len; i++)
-				addch(' ');
+			if(replay && !(flags & MTX_FLAG_PAUSE))
+			{
+				/* the recording says when the next frame is. */
+				frame_deadline = rp_due(t3);
+				behind = frame_deadline < t3;
+			}
+			else if(!bench_frames)
+				behind = frame_next(update * 10000000ULL);
 		}
 
 		/* get user input. */
-		/* this also redraws the screen, because curses is weird. */
-		if((keypress = getch()) != ERR)
+		if(keypress != ERR)
 		{
 			/* if screensaver, exit on keypress. */
-			if(flags & MTX_FLAG_SCRSAVE)
+			if((flags & MTX_FLAG_SCRSAVE) && typed)
 			{
 #ifdef USE_TIOCSTI
 				/* collect immediately following keypresses into str. */
@@ -953,7 +4550,7 @@ int main(int argc, char *argv[])
 				{
 					str = realloc(str, str_len + 1);
 					str[str_len++] = keypress;
-				} while((keypress = getch()) != ERR);
+				} while((keypress = get_key()) != ERR);
 				/* type chars to tty so the shell can see them. */
 				for(i=0; i<str_len; i++)
 					ioctl(STDIN_FILENO, TIOCSTI, (char*)(str + i));
@@ -977,7 +4574,7 @@ int main(int argc, char *argv[])
 					case 'b': flags = (flags & ~MTX_FLAG_BOLD) | MTX_FLAG_BOLD_SOME; break;
 					case 'B': flags = (flags & ~MTX_FLAG_BOLD) | MTX_FLAG_BOLD_ALL; break;
 					case 'n': case 'N': flags &= ~MTX_FLAG_BOLD; break;
-					case 'o': case 'O': flags ^= MTX_FLAG_OLD; break;
+					case 'o': case 'O': toggle_old_scroll(); break;
 					case '0': case '1': case '2': case '3': case '4': case '5': case '6': case '7': case '8': case '9':
 						update = keypress - '0';
 						break;
@@ -1019,13 +4616,50 @@ int main(int argc, char *argv[])
 #endif
 					case 'p': case 'P': flags ^= MTX_FLAG_PAUSE; break;
 					case 'k': case 'K': flags ^= MTX_FLAG_CHANGES; break;
+					/* back and forward through a recording. */
+					case '[': case ']':
+						if(replay)
+						{
+							rp_seek((int64_t) rp_us + (keypress == '[' ? -10000000 : 10000000), now_ns());
+							frame_deadline = now_ns();
+						}
+						break;
+					case 'f': case 'F':
+						/* the render thread hides it itself. */
+						if((flags & MTX_FLAG_HUD) && !(flags & MTX_FLAG_PIPELINE))
+							hud_hide();
+						else
+							hud_when = 0;
+						flags ^= MTX_FLAG_HUD;
+						break;
 				}
 			}
 		}
 
-		/* next iteration. */
-		count = (count % 4) + 1;
-		napms(update * 10);
+		/* a key might have changed which kernels we want. */
+		kernels_select();
+
+		/* paused or out of focus, nothing moves, so nothing needs
+		   drawing, and we sleep until a key or signal changes that.
+		   a key might still change how it looks, so it gets a frame. */
+		stopped = !bench_frames && ((flags & MTX_FLAG_PAUSE) || !focused);
+		if(stopped)
+		{
+			if(replay)
+				rp_pause(now_ns());
+			/* however long this goes on isn't a frame taking that long. */
+			last_t0 = 0;
+			due = keypress != ERR || event_wait(1);
+		}
+		else
+		{
+			/* picking up where we left off is a frame straight away. */
+			if(was_stopped)
+				frame_deadline = now_ns();
+			/* sleep until the next frame, or until there's a key or signal. */
+			due = bench_frames || event_wait(0);
+		}
+		was_stopped = stopped;
 	}
 	finish();
 }